@@ -0,0 +1,66 @@
+#!/bin/bash
+# Run two bench builds through the run.sh workload and show how much
+# more throughput the second one gets, per run and overall. Builds take
+# turns for BENCH_ROUNDS rounds and the best time of each is kept, so
+# one noisy moment doesn't decide it.
+VER="1.0"
+
+BASE=$1
+NEW=$2
+ROUNDS=${BENCH_ROUNDS:-3}
+
+if [ ! -x "$BASE" ] || [ ! -x "$NEW" ]; then
+	echo "Usage: $0 <baseline> <candidate>"
+	exit 1
+fi
+
+# Scratch results for each build
+OUT=$(mktemp /tmp/bluelog-compare.XXXXXX)
+#------------------------------------------------------------------------------#
+for ROUND in $(seq $ROUNDS); do
+	echo "Round $ROUND of $ROUNDS..."
+	BENCH="$BASE" BENCH_OUT="$OUT.base" ./bench/run.sh > /dev/null
+	BENCH="$NEW" BENCH_OUT="$OUT.new" ./bench/run.sh > /dev/null
+done
+
+printf "%-12s %8s %7s %12s %12s %10s\n" "Run" "Devices" "Repeat" "Baseline" "Candidate" "Throughput"
+awk '
+# Value of key in one line of bench JSON
+function field(line, key,   value)
+{
+	if (!match(line, "\"" key "\":\"?[^,\"}]*"))
+		return ""
+	value = substr(line, RSTART, RLENGTH)
+	sub(/^"[^"]*":"?/, "", value)
+	return value
+}
+{
+	run = field($0, "label") " " field($0, "devices") " " field($0, "repeat")
+	ns = field($0, "ns_per_result") + 0
+}
+FNR == NR {
+	if (!(run in base))
+		order[++runs] = run
+	if (!(run in base) || ns < base[run])
+		base[run] = ns
+	next
+}
+!(run in new) || ns < new[run] {
+	new[run] = ns
+}
+END {
+	for (i = 1; i <= runs; i++)
+	{
+		run = order[i]
+		if (!(run in new) || base[run] <= 0 || new[run] <= 0)
+			continue
+		split(run, r, " ")
+		printf "%-12s %8s %7s %12.1f %12.1f %+9.1f%%\n", r[1], r[2], r[3], base[run], new[run], (base[run] / new[run] - 1) * 100
+		logsum += log(base[run] / new[run])
+		count++
+	}
+	if (count)
+		printf "Overall throughput change (geometric mean): %+.1f%%\n", (exp(logsum / count) - 1) * 100
+}' "$OUT.base" "$OUT.new"
+
+rm -f "$OUT" "$OUT.base" "$OUT.new"
@@ -0,0 +1,320 @@
+/*
+ *  fakehci - Synthetic inquiry results for benchmarking Bluelog
+ *
+ *  Linked into Bluelog in place of the HCI calls from BlueZ, so the whole
+ *  result processing loop (cache, amnesia, encoding, vendor and class
+ *  lookups, output) runs against generated devices with no radio attached.
+ *  HCI sockets are socket pairs, and an Inquiry command gets all of its
+ *  result events and Inquiry Complete written back at once. Only the time
+ *  Bluelog spends between Inquiry commands is counted. Controlled with
+ *  environment variables:
+ *
+ *    BENCH_DEVICES     Devices in the population (10000)
+ *    BENCH_RESULTS     Results per inquiry (64)
+ *    BENCH_REPEAT      Chance a result is a device already seen (0.8)
+ *    BENCH_NAMEFAIL    Chance a name request fails (0.1)
+ *    BENCH_NAMEDELAY   Microseconds each name request takes (0)
+ *    BENCH_INQUIRIES   Inquiries to run before reporting (2000)
+ *    BENCH_SEED        Random seed (1)
+ *    BENCH_LABEL       Name for this run in the results
+ *    BENCH_OUT         Append JSON result here, otherwise stdout
+ *
+ *  Allocations are counted by wrapping malloc, calloc and realloc, which
+ *  relies on glibc's __libc_ versions of them. setsockopt() is wrapped too,
+ *  so the HCI filter can be set on a fake socket.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+
+// Real allocators in glibc
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t count, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+// Some common OUIs, so vendor lookups find something if there's a database
+static const uint32_t bench_ouis[] =
+{
+	0x001B63, 0x0021E9, 0x00236C, 0x0026BB, 0x3C0754, 0x7CD1C3,
+	0x001E7D, 0x0024E9, 0x5C0A5B, 0x8C7712, 0xA01081, 0xF8D0BD,
+	0x0019C1, 0x001F3A, 0x0025D3, 0x606BBD,
+};
+
+// Settings, read on first inquiry
+static int bench_devices, bench_results, bench_inquiries;
+static double bench_repeat, bench_namefail;
+static int bench_namedelay;
+static const char *bench_label, *bench_out;
+
+// Progress
+static int bench_ready = 0;
+static int bench_issued = 0;
+static int bench_done = 0;
+static uint64_t bench_total = 0;
+static uint64_t bench_rng;
+
+// Name requests can come from another thread in pipeline mode
+static __thread uint64_t bench_name_rng;
+
+// Time spent in Bluelog rather than in here
+static double bench_busy = 0;
+static double bench_left = 0;
+
+// Other end of each fake HCI socket, plus one
+#define BENCH_FDS 1024
+static int bench_peer[BENCH_FDS];
+
+// Allocations while the clock is running
+static volatile int bench_counting = 0;
+static uint64_t bench_allocs = 0;
+
+void *malloc (size_t size)
+{
+	if (bench_counting)
+		bench_allocs++;
+	return(__libc_malloc(size));
+}
+
+void *calloc (size_t count, size_t size)
+{
+	if (bench_counting)
+		bench_allocs++;
+	return(__libc_calloc(count, size));
+}
+
+void *realloc (void *ptr, size_t size)
+{
+	if (bench_counting)
+		bench_allocs++;
+	return(__libc_realloc(ptr, size));
+}
+
+int setsockopt (int fd, int level, int name, const void *value, socklen_t len)
+{
+	if (level == SOL_HCI && name == HCI_FILTER && fd >= 0 && fd < BENCH_FDS && bench_peer[fd])
+		return(0);
+	return(syscall(SYS_setsockopt, fd, level, name, value, len));
+}
+
+static double bench_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+// xorshift64*, same sequence for the same seed on every build
+static uint64_t bench_rand (void)
+{
+	bench_rng ^= bench_rng >> 12;
+	bench_rng ^= bench_rng << 25;
+	bench_rng ^= bench_rng >> 27;
+	return(bench_rng * 0x2545F4914F6CDD1DULL);
+}
+
+static double bench_chance (void)
+{
+	return((bench_rand() >> 11) / 9007199254740992.0);
+}
+
+static double bench_env (const char *name, double fallback)
+{
+	const char *value = getenv(name);
+
+	return((value != NULL && *value) ? atof(value) : fallback);
+}
+
+static void bench_setup (void)
+{
+	bench_devices = bench_env("BENCH_DEVICES", 10000);
+	bench_results = bench_env("BENCH_RESULTS", 64);
+	bench_repeat = bench_env("BENCH_REPEAT", 0.8);
+	bench_namefail = bench_env("BENCH_NAMEFAIL", 0.1);
+	bench_namedelay = bench_env("BENCH_NAMEDELAY", 0);
+	bench_inquiries = bench_env("BENCH_INQUIRIES", 2000);
+	bench_rng = bench_env("BENCH_SEED", 1) * 0x9E3779B97F4A7C15ULL + 1;
+	bench_label = getenv("BENCH_LABEL") ? getenv("BENCH_LABEL") : "";
+	bench_out = getenv("BENCH_OUT");
+
+	if (bench_devices < 1)
+		bench_devices = 1;
+	if (bench_inquiries < 1)
+		bench_inquiries = 1;
+	bench_ready = 1;
+}
+
+// Device number to address and class, the same device always looks the same
+static void bench_device (int number, inquiry_info *info)
+{
+	uint64_t mix = (number + 1) * 0x9E3779B97F4A7C15ULL;
+	uint32_t oui = bench_ouis[(mix >> 20) % (sizeof(bench_ouis) / sizeof(bench_ouis[0]))];
+
+	memset(info, 0, sizeof(*info));
+	info->bdaddr.b[0] = number;
+	info->bdaddr.b[1] = number >> 8;
+	info->bdaddr.b[2] = (number >> 16) ^ (mix >> 56);
+	info->bdaddr.b[3] = oui;
+	info->bdaddr.b[4] = oui >> 8;
+	info->bdaddr.b[5] = oui >> 16;
+	info->dev_class[2] = mix >> 8;
+	info->dev_class[1] = (mix >> 16) % 10;
+	info->dev_class[0] = (mix >> 24) & 0xfc;
+}
+
+static void bench_report (void)
+{
+	struct rusage usage;
+	char line[512];
+	FILE *out;
+
+	getrusage(RUSAGE_SELF, &usage);
+	snprintf(line, sizeof(line), "{\"label\":\"%s\",\"devices\":%i,\"results_per_inquiry\":%i,"
+		"\"repeat\":%.2f,\"namefail\":%.2f,\"inquiries\":%i,\"results\":%llu,"
+		"\"ns_per_result\":%.1f,\"allocs_per_result\":%.3f,\"peak_rss_kb\":%ld}\n",
+		bench_label, bench_devices, bench_results, bench_repeat, bench_namefail,
+		bench_inquiries, (unsigned long long)bench_total,
+		bench_total ? bench_busy / bench_total : 0.0,
+		bench_total ? (double)bench_allocs / bench_total : 0.0,
+		usage.ru_maxrss);
+
+	if (bench_out != NULL && (out = fopen(bench_out, "a")) != NULL)
+	{
+		fputs(line, out);
+		fclose(out);
+	}
+	else
+		fputs(line, stdout);
+}
+
+// Write out results as Inquiry Result events, as many per event as fit
+static void bench_events (int peer, inquiry_info *info, int count)
+{
+	unsigned char buf[HCI_MAX_EVENT_SIZE];
+	int i, n, per = (255 - 1) / INQUIRY_INFO_SIZE;
+
+	for (i = 0; i < count; i += n)
+	{
+		n = (count - i < per) ? count - i : per;
+		buf[0] = HCI_EVENT_PKT;
+		buf[1] = EVT_INQUIRY_RESULT;
+		buf[2] = 1 + n * INQUIRY_INFO_SIZE;
+		buf[3] = n;
+		memcpy(buf + 4, info + i, n * INQUIRY_INFO_SIZE);
+		if (write(peer, buf, 4 + n * INQUIRY_INFO_SIZE) < 0)
+			return;
+	}
+
+	buf[1] = EVT_INQUIRY_COMPLETE;
+	buf[2] = 1;
+	buf[3] = 0;
+	if (write(peer, buf, 4) < 0)
+		return;
+}
+
+int hci_send_cmd (int dd, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param)
+{
+	static inquiry_info info[255];
+	inquiry_cp *cp = param;
+	double now = bench_now();
+	int i, count, number;
+
+	if (dd < 0 || dd >= BENCH_FDS || !bench_peer[dd])
+		return(-1);
+	if (ogf != OGF_LINK_CTL || ocf != OCF_INQUIRY)
+		return(0);
+
+	// Count the time since the last inquiry returned
+	bench_counting = 0;
+	if (bench_left > 0)
+		bench_busy += now - bench_left;
+
+	if (!bench_ready)
+		bench_setup();
+
+	if (bench_done == bench_inquiries)
+	{
+		bench_report();
+		// Same exit as Ctrl+C, so files get closed as usual
+		raise(SIGINT);
+		return(0);
+	}
+	bench_done++;
+
+	count = (bench_results < cp->num_rsp) ? bench_results : cp->num_rsp;
+	for (i = 0; i < count; i++)
+	{
+		if (bench_issued == 0 || (bench_issued < bench_devices && bench_chance() >= bench_repeat))
+			number = bench_issued++;
+		else
+			number = bench_rand() % bench_issued;
+		bench_device(number, &info[i]);
+	}
+	bench_events(bench_peer[dd] - 1, info, count);
+	bench_total += count;
+
+	bench_counting = 1;
+	bench_left = bench_now();
+	return(0);
+}
+
+int hci_read_remote_name (int sock, const bdaddr_t *ba, int len, char *name, int to)
+{
+	// Own sequence per thread, same one every run
+	if (bench_name_rng == 0)
+		bench_name_rng = bench_env("BENCH_SEED", 1) * 0xBF58476D1CE4E5B9ULL + 1;
+	bench_name_rng ^= bench_name_rng >> 12;
+	bench_name_rng ^= bench_name_rng << 25;
+	bench_name_rng ^= bench_name_rng >> 27;
+
+	if (bench_namedelay > 0)
+		usleep(bench_namedelay);
+	if (((bench_name_rng * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0 < bench_namefail)
+		return(-1);
+	snprintf(name, len, "Bench %02X%02X%02X", ba->b[2], ba->b[1], ba->b[0]);
+	return(0);
+}
+
+int hci_devba (int dev_id, bdaddr_t *ba)
+{
+	memset(ba, 0, sizeof(*ba));
+	ba->b[0] = dev_id + 1;
+	return(0);
+}
+
+int hci_get_route (bdaddr_t *ba)
+{
+	return(0);
+}
+
+int hci_devid (const char *str)
+{
+	return(0);
+}
+
+// Socket pair, Bluelog reads one end and the other is ours
+int hci_open_dev (int dev_id)
+{
+	int pair[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0 || pair[0] >= BENCH_FDS)
+		return(-1);
+	fcntl(pair[1], F_SETFL, fcntl(pair[1], F_GETFL) | O_NONBLOCK);
+	bench_peer[pair[0]] = pair[1] + 1;
+	return(pair[0]);
+}
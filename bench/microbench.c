@@ -0,0 +1,330 @@
+/*
+ *  microbench - Time libmackerel and device class kernels
+ *
+ *  Runs each kernel over a batch of addresses that look like a real scan
+ *  (mostly common OUIs, some random), first to warm up and then for a
+ *  number of timed samples, and reports ns per call as min, median, mean,
+ *  95th percentile and standard deviation. The process is pinned to one
+ *  CPU so samples aren't spread across cores with different clocks.
+ *
+ *  Usage: microbench [-c cpu] [-s samples] [-w warmup] [-f filter] [-j]
+ *
+ *  Vendor lookups use oui.db or oui.txt from the current directory if
+ *  either is there (see "make ouifile"), otherwise they only time the
+ *  miss path.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <math.h>
+#include <time.h>
+#include <bluetooth/bluetooth.h>
+
+#define OUIFILE "oui.txt"
+#define OUIDB "oui.db"
+#include "../libmackerel.c"
+#include "../classes.c"
+
+// Addresses per batch, and default passes over it
+#define BATCH 4096
+#define SAMPLES 200
+#define WARMUP 20
+
+// Share of addresses from common OUIs, the rest are random
+#define COMMON_SHARE 0.7
+
+// Same OUIs as fakehci, a few big phone and laptop vendors
+static const uint32_t common_ouis[] =
+{
+	0x001B63, 0x0021E9, 0x00236C, 0x0026BB, 0x3C0754, 0x7CD1C3,
+	0x001E7D, 0x0024E9, 0x5C0A5B, 0x8C7712, 0xA01081, 0xF8D0BD,
+	0x0019C1, 0x001F3A, 0x0025D3, 0x606BBD,
+};
+
+bdaddr_t addrs[BATCH];
+bdaddr_t parsed[BATCH];
+char text[BATCH * MAC_STR_LEN];
+uint8_t classes[BATCH][3];
+char out[MAC_STR_LEN];
+
+// Keeps the compiler from throwing results away
+volatile unsigned int sink;
+
+// Settings from command line
+int samples = SAMPLES;
+int warmup = WARMUP;
+int json = 0;
+const char *filter = NULL;
+
+static double now (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+// Kernels, each does one pass over the batch
+static void run_ba2str (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		ba2str(&addrs[i], text + i * MAC_STR_LEN);
+	sink += text[0];
+}
+
+static void run_mac_format_many (void)
+{
+	mac_format_many(addrs, text, BATCH);
+	sink += text[0];
+}
+
+static void run_str2ba (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		str2ba(text + i * MAC_STR_LEN, &parsed[i]);
+	sink += parsed[0].b[0];
+}
+
+static void run_mac_parse_many (void)
+{
+	sink += mac_parse_many(text, parsed, BATCH);
+}
+
+static void run_mac_verify (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += mac_verify(text + i * MAC_STR_LEN);
+}
+
+static void run_mac_encode (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += mac_encode(text + i * MAC_STR_LEN)[0];
+}
+
+static void run_mac_encode_r (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += mac_encode_r(&addrs[i], out)[0];
+}
+
+static void run_mac_obfuscate (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += mac_obfuscate(text + i * MAC_STR_LEN)[0];
+}
+
+static void run_mac_obfuscate_r (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += mac_obfuscate_r(&addrs[i], out)[0];
+}
+
+static void run_mac_get_vendor (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += mac_get_vendor(text + i * MAC_STR_LEN)[0];
+}
+
+static void run_mac_get_vendor_r (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += mac_get_vendor_r(&addrs[i])[0];
+}
+
+static void run_device_class (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += device_class(classes[i][1], classes[i][0])[0];
+}
+
+static void run_device_capability (void)
+{
+	int i;
+	for (i = 0; i < BATCH; i++)
+		sink += device_capability(classes[i][2])[0];
+}
+
+// Run order matters, parse cases read what the format cases wrote
+static const struct
+{
+	const char *name;
+	void (*run)(void);
+} kernels[] =
+{
+	{ "ba2str", run_ba2str },
+	{ "str2ba", run_str2ba },
+	{ "mac_format_many", run_mac_format_many },
+	{ "mac_parse_many", run_mac_parse_many },
+	{ "mac_verify", run_mac_verify },
+	{ "mac_encode", run_mac_encode },
+	{ "mac_encode_r", run_mac_encode_r },
+	{ "mac_obfuscate", run_mac_obfuscate },
+	{ "mac_obfuscate_r", run_mac_obfuscate_r },
+	{ "mac_get_vendor", run_mac_get_vendor },
+	{ "mac_get_vendor_r", run_mac_get_vendor_r },
+	{ "device_class", run_device_class },
+	{ "device_capability", run_device_capability },
+};
+
+static int compare_double (const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return((x > y) - (x < y));
+}
+
+// Warm up, then time each pass, in ns per call
+static void measure (int k, double *times)
+{
+	static int shown = 0;
+	double start, mean = 0, var = 0;
+	int s;
+
+	for (s = 0; s < warmup; s++)
+		kernels[k].run();
+
+	for (s = 0; s < samples; s++)
+	{
+		start = now();
+		kernels[k].run();
+		times[s] = (now() - start) / BATCH;
+	}
+
+	qsort(times, samples, sizeof(double), compare_double);
+	for (s = 0; s < samples; s++)
+		mean += times[s];
+	mean /= samples;
+	for (s = 0; s < samples; s++)
+		var += (times[s] - mean) * (times[s] - mean);
+	var = samples > 1 ? var / (samples - 1) : 0;
+
+	if (json)
+		printf("%s{\"kernel\":\"%s\",\"min\":%.2f,\"median\":%.2f,\"mean\":%.2f,\"p95\":%.2f,\"stddev\":%.2f}",
+			shown++ ? ",\n" : "", kernels[k].name, times[0], times[samples / 2], mean,
+			times[(samples * 95) / 100], sqrt(var));
+	else
+		printf("%-20s %8.2f %8.2f %8.2f %8.2f %8.2f\n", kernels[k].name, times[0],
+			times[samples / 2], mean, times[(samples * 95) / 100], sqrt(var));
+}
+
+// Mostly common vendors, like a real scan would see
+static void make_addresses (void)
+{
+	uint32_t oui;
+	int i, r;
+
+	srand(1);
+	for (i = 0; i < BATCH; i++)
+	{
+		for (r = 0; r < 6; r++)
+			addrs[i].b[r] = rand();
+		if (rand() < COMMON_SHARE * RAND_MAX)
+		{
+			oui = common_ouis[rand() % (sizeof(common_ouis) / sizeof(common_ouis[0]))];
+			addrs[i].b[3] = oui;
+			addrs[i].b[4] = oui >> 8;
+			addrs[i].b[5] = oui >> 16;
+		}
+		classes[i][2] = rand();
+		classes[i][1] = rand() % 10;
+		classes[i][0] = rand() & 0xfc;
+	}
+	mac_format_many(addrs, text, BATCH);
+}
+
+static void usage (void)
+{
+	printf("Usage: microbench [-c cpu] [-s samples] [-w warmup] [-f filter] [-j]\n");
+	exit(1);
+}
+
+int main (int argc, char *argv[])
+{
+	double *times;
+	cpu_set_t cpus;
+	int cpu = -1, opt, k;
+
+	while ((opt = getopt(argc, argv, "c:s:w:f:j")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 's':
+			samples = atoi(optarg);
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (samples < 1 || warmup < 0)
+		usage();
+
+	// Stay on whatever CPU we started on unless told otherwise
+	if (cpu < 0)
+		cpu = sched_getcpu();
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+	{
+		fprintf(stderr, "Unable to pin to CPU %i, results may be noisy\n", cpu);
+		cpu = -1;
+	}
+
+	mac_init();
+	if (mac_oui_load(OUIDB) && mac_oui_load(OUIFILE))
+		fprintf(stderr, "No OUI database, vendor lookups will all miss\n");
+	make_addresses();
+	times = malloc(samples * sizeof(double));
+
+	if (json)
+		printf("{\"batch\":%i,\"samples\":%i,\"warmup\":%i,\"cpu\":%i,\"oui_entries\":%i,\"results\":[\n",
+			BATCH, samples, warmup, cpu, oui_count);
+	else
+		printf("%-20s %8s %8s %8s %8s %8s  (ns/call, %i samples, CPU %i)\n",
+			"Kernel", "min", "median", "mean", "p95", "stddev", samples, cpu);
+
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+		if (filter == NULL || strstr(kernels[k].name, filter))
+			measure(k, times);
+
+	if (json)
+		printf("\n]}\n");
+
+	// Make sure the round trip actually worked
+	if (filter == NULL && memcmp(addrs, parsed, sizeof(addrs)))
+	{
+		printf("Round trip mismatch!\n");
+		return(1);
+	}
+
+	free(times);
+	return(0);
+}
@@ -0,0 +1,64 @@
+#!/bin/bash
+# Run Bluelog against fakehci with a set of option combinations
+# and device populations, results are appended to BENCH_OUT as JSON
+VER="1.0"
+
+# Binary to run, override with BENCH to run another build
+BENCH=${BENCH:-"./bench/bluelog-bench"}
+
+# Where results go, one JSON object per line
+export BENCH_OUT=${BENCH_OUT:-"bench/results.json"}
+
+# Scratch log file
+LOGFILE=$(mktemp /tmp/bluelog-bench.XXXXXX)
+
+# Populations as devices:repeat ratio, override with BENCH_POPULATIONS
+POPULATIONS=${BENCH_POPULATIONS:-"1000:0.95 20000:0.5"}
+
+# Name and Bluelog options for each run
+RUNS=(
+	"plain|-q"
+	"names|-q -n"
+	"pipeline|-q -n --pipeline"
+	"class_time|-q -t -c -f"
+	"obfuscate|-q -x"
+	"encode|-q -e"
+	"amnesia|-q -n -a 0"
+	"vendor|-q -n -m"
+	"syslog|-q -n -s"
+	"live|-q -l"
+	"all|-q -n -t -f -e -m -a 0"
+)
+#------------------------------------------------------------------------------#
+if [ ! -x "$BENCH" ]; then
+	echo "$BENCH not found, run \"make bench\""
+	exit 1
+fi
+
+printf "%-12s %8s %7s %12s %12s %10s\n" "Run" "Devices" "Repeat" "ns/result" "allocs/res" "RSS (KB)"
+for POP in $POPULATIONS; do
+	for RUN in "${RUNS[@]}"; do
+		NAME=${RUN%%|*}
+		OPTS=${RUN#*|}
+
+		# Live and vendor options are not in every build
+		if ! BENCH_LABEL="$NAME" BENCH_DEVICES=${POP%%:*} BENCH_REPEAT=${POP#*:} \
+			BENCH_OUT="$LOGFILE.json" $BENCH $OPTS -o $LOGFILE > /dev/null 2>&1 < /dev/null; then
+			if [ ! -s "$LOGFILE.json" ]; then
+				printf "%-12s skipped\n" "$NAME"
+				continue
+			fi
+		fi
+
+		cat "$LOGFILE.json" >> "$BENCH_OUT"
+		sed -e 's/.*"devices":\([0-9]*\).*"repeat":\([0-9.]*\).*"ns_per_result":\([0-9.]*\),"allocs_per_result":\([0-9.]*\),"peak_rss_kb":\([0-9]*\).*/\1 \2 \3 \4 \5/' \
+			"$LOGFILE.json" | while read DEV REP NS ALLOC RSS; do
+			printf "%-12s %8s %7s %12s %12s %10s\n" "$NAME" "$DEV" "$REP" "$NS" "$ALLOC" "$RSS"
+		done
+		rm -f "$LOGFILE.json" "$LOGFILE"
+	done
+done
+
+# Live mode leaves these behind
+rm -f /tmp/live.log /tmp/live.idx /tmp/info.txt
+echo "Results written to $BENCH_OUT"
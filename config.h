@@ -5,6 +5,15 @@
 // Generic 
 #define MAX_SCAN 30
 #define MIN_SCAN 3
+#define SOCK_FILE "/tmp/bluelog.sock"
+// Live log records allowed past twice the device count before compacting
+#define LIVE_COMPACT 256
+// Seconds between writes of the metrics file
+#define METRICS_INTERVAL 10
+// Seconds past the scan window before an inquiry is given up on
+#define INQUIRY_GRACE 10
+// Events handled per wakeup of the event loop
+#define LOOP_EVENTS 16
 
 // Device specific
 
@@ -17,8 +26,11 @@
 #define OUT_PATH "/tmp/"
 #define LIVE_OUT "/tmp/live.log"
 #define LIVE_INF "/tmp/info.txt"
+#define LIVE_IDX "/tmp/live.idx"
+#define HTTP_ROOT "/www/bluelog"
 #define PID_FILE "/tmp/bluelog.pid"
 #define OUIFILE ""
+#define OUIDB ""
 #define CFG_FILE "/etc/bluelog/bluelog.conf"
 // Pwnie Express Pwn Plug
 #elif PWNPLUG
@@ -29,8 +41,11 @@
 #define OUT_PATH "/dev/shm/"
 #define LIVE_OUT "/tmp/live.log"
 #define LIVE_INF "/tmp/info.txt"
+#define LIVE_IDX "/tmp/live.idx"
+#define HTTP_ROOT "/var/www/bluelog"
 #define PID_FILE "/tmp/bluelog.pid"
 #define OUIFILE ""
+#define OUIDB ""
 #define CFG_FILE "/etc/bluelog/bluelog.conf"
 // Pwnie Express Pwn Pad
 #elif PWNPAD
@@ -41,8 +56,11 @@
 #define OUT_PATH "/opt/pwnpad/captures/bluetooth/"
 #define LIVE_OUT ""
 #define LIVE_INF ""
+#define LIVE_IDX ""
+#define HTTP_ROOT ""
 #define PID_FILE "/tmp/bluelog.pid"
 #define OUIFILE "/usr/share/bluelog/oui.txt"
+#define OUIDB "/usr/share/bluelog/oui.db"
 #define CFG_FILE "/etc/bluelog/bluelog.conf"
 #else
 // Generic x86
@@ -53,8 +71,11 @@
 #define OUT_PATH ""
 #define LIVE_OUT "/tmp/live.log"
 #define LIVE_INF "/tmp/info.txt"
+#define LIVE_IDX "/tmp/live.idx"
+#define HTTP_ROOT "/usr/share/bluelog"
 #define PID_FILE "/tmp/bluelog.pid"
 #define OUIFILE "/etc/bluelog/oui.txt"
+#define OUIDB "/etc/bluelog/oui.db"
 #define CFG_FILE "/etc/bluelog/bluelog.conf"
 #endif
 
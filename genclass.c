@@ -0,0 +1,249 @@
+/*
+ *  genclass - Generate Class of Device lookup tables for Bluelog
+ *
+ *  Runs at build time and writes classtab.h, which maps every major and
+ *  minor class (and every set of service flags) to a constant string, so
+ *  classes.c never has to build strings at run time. Each distinct string
+ *  appears only once, and gets a small numeric ID for binary output.
+ *
+ *  The class names are based on code from "Inquisition", a Bluetooth
+ *  scanner written by Michael John Wensley and released under the GPLv2
+ *  More info can be found at: http://www.wensley.org.uk/
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Defines
+#define APPNAME "genclass"
+#define VERSION "1.0"
+
+// Major class is 5 bits, minor is 6
+#define MAJORS 32
+#define MINORS 64
+
+// Device classes
+#define ENT(e) (sizeof(e)/sizeof(char*))
+static char *majors[] = {" Misc", " Computer", " Phone", " Network", " A/V",\
+                         " Peripheral", " Imaging", " Wearable", " Toy", " Health"};
+
+static char* computers[] = {"Misc", "Desktop", "Server", "Laptop", "Handheld",\
+                            "Palm", "Wearable"};
+
+static char* phones[] = {"Misc", "Cell", "Cordless", "Smart", "Wired",\
+                         "ISDN", "Sim Card Reader For "};
+
+static char* av[] = {"Misc", "Headset", "Handsfree", "Reserved", "Microphone",\
+                "Loudspeaker", "Headphones", "Portable", "Car", "STB", "HiFi",\
+                "VCR", "Video Camera", "Camcorder",\
+                "Video Display and Loudspeaker", "Video Conferencing",\
+                "Reserved", "Game / Toy"};
+
+static char* peripheral[] = {"Misc", "Joystick", "Gamepad", "Remote control",\
+                "Sensing device", "Digitiser Tablet", "Card Reader"};
+
+static char* wearable[] = {"Misc", "Wrist Watch", "Pager", "Jacket", "Helmet",\
+                           "Glasses"};
+
+static char* toys[] = {"Misc", "Robot", "Vehicle", "Character", "Controller",\
+                       "Game"};
+
+static char* health[] = {"Misc", "Blood Pressure Monitor", "Thermometer",\
+                "Weighing Scale", "Glucose Meter", "Pulse Oximeter",\
+                "Heart Rate Monitor", "Health Data Display", "Step Counter",\
+                "Body Composition Analyzer", "Peak Flow Monitor",\
+                "Medication Monitor", "Knee Prosthesis", "Ankle Prosthesis",\
+                "Generic Health Manager", "Personal Mobility Device"};
+
+// Service flags, in bit order
+static char* capabilities[] = {"Position", "Net", "Render", "Capture", "OBEX",\
+                               "Audio", "Phone"};
+// End device classes
+
+// Interned strings, ID is position in list
+static char* strings[MAJORS * MINORS];
+static int string_count = 0;
+
+// Return ID of string, adding it if it's new
+static int intern (const char* text)
+{
+	int i;
+
+	for (i = 0; i < string_count; i++)
+		if (!strcmp(strings[i], text))
+			return(i);
+
+	strings[string_count] = strdup(text);
+	return(string_count++);
+}
+
+// Build name of device class the same way Bluelog always has
+static void class_name (int major, int minor, char* name)
+{
+	name[0] = '\0';
+
+	switch (major)
+	{
+	case 1:
+		if (minor < ENT(computers))
+			strcat(name, computers[minor]);
+		break;
+	case 2:
+		if (minor < ENT(phones))
+			strcat(name, phones[minor]);
+		break;
+	case 3:
+		// Minor is load factor, nothing to name
+		break;
+	case 4:
+		if (minor < ENT(av))
+			strcat(name, av[minor]);
+		break;
+	case 5:
+		if ((minor & 0xF) < ENT(peripheral))
+			strcat(name, peripheral[(minor & 0xF)]);
+		if (minor & 0x10)
+			strcat(name, " with keyboard");
+		if (minor & 0x20)
+			strcat(name, " with pointer");
+		break;
+	case 6:
+		if (minor & 0x2)
+			strcat(name, " with display");
+		if (minor & 0x4)
+			strcat(name, " with camera");
+		if (minor & 0x8)
+			strcat(name, " with scanner");
+		if (minor & 0x10)
+			strcat(name, " with printer");
+		break;
+	case 7:
+		if (minor < ENT(wearable))
+			strcat(name, wearable[minor]);
+		break;
+	case 8:
+		if (minor < ENT(toys))
+			strcat(name, toys[minor]);
+		break;
+	case 9:
+		if (minor < ENT(health))
+			strcat(name, health[minor]);
+		break;
+	case 31:
+		// Minor has no meaning
+		strcpy(name, "Uncategorized");
+		return;
+	default:
+		// Handle unknown devices, leave early.
+		strcpy(name, "VOID");
+		return;
+	}
+	strcat(name, majors[major]);
+}
+
+// Build list of service flags
+static void capability_name (int flags, char* name)
+{
+	int i;
+
+	name[0] = '\0';
+	for (i = 0; i < ENT(capabilities); i++)
+	{
+		if (!(flags & (1 << i)))
+			continue;
+		if (name[0])
+			strcat(name, " ");
+		strcat(name, capabilities[i]);
+	}
+
+	// If all else fails, give it something to show
+	if (name[0] == '\0')
+		strcpy(name, "VOID");
+}
+
+// Print string as C literal
+static void print_literal (FILE* out, const char* text)
+{
+	fputc('"', out);
+	for (; *text; text++)
+	{
+		if (*text == '"' || *text == '\\')
+			fputc('\\', out);
+		fputc(*text, out);
+	}
+	fputc('"', out);
+}
+
+int main(int argc, char *argv[])
+{
+	static int class_ids[MAJORS][MINORS];
+	char name[256];
+	int major, minor, flags;
+	FILE* out;
+
+	if (argc != 2)
+	{
+		printf("%s (v%s) by MS3FGX\n", APPNAME, VERSION);
+		printf("usage: %s <classtab.h>\n", argv[0]);
+		exit(1);
+	}
+
+	// VOID always comes first, so ID 0 means unknown
+	intern("VOID");
+	for (major = 0; major < MAJORS; major++)
+	{
+		for (minor = 0; minor < MINORS; minor++)
+		{
+			class_name(major, minor, name);
+			class_ids[major][minor] = intern(name);
+		}
+	}
+
+	if ((out = fopen(argv[1], "w")) == NULL)
+	{
+		printf("Unable to write %s!\n", argv[1]);
+		exit(1);
+	}
+
+	fprintf(out, "// Generated by %s, do not edit\n\n", APPNAME);
+
+	fprintf(out, "// Device class names, indexed by class ID\n");
+	fprintf(out, "#define CLASS_NAMES %i\n", string_count);
+	fprintf(out, "static const char* const class_names[CLASS_NAMES] = {\n");
+	for (major = 0; major < string_count; major++)
+	{
+		fprintf(out, "\t");
+		print_literal(out, strings[major]);
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "// Class ID for major and minor class\n");
+	fprintf(out, "static const uint16_t class_ids[%i][%i] = {\n", MAJORS, MINORS);
+	for (major = 0; major < MAJORS; major++)
+	{
+		fprintf(out, "\t{");
+		for (minor = 0; minor < MINORS; minor++)
+			fprintf(out, "%s%i", minor ? "," : "", class_ids[major][minor]);
+		fprintf(out, "},\n");
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "// Capability names for service flags\n");
+	fprintf(out, "static const char* const capability_names[%i] = {\n", 1 << ENT(capabilities));
+	for (flags = 0; flags < (1 << ENT(capabilities)); flags++)
+	{
+		capability_name(flags, name);
+		fprintf(out, "\t");
+		print_literal(out, name);
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "};\n");
+
+	fclose(out);
+	return 0;
+}
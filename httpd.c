@@ -0,0 +1,546 @@
+/*
+ *  httpd.c - Built-in web server for Bluelog Live
+ *
+ *  Serves the Bluelog Live pages without an external web server or CGI.
+ *  Static files (HTML, CSS themes, images) come from the web root, and
+ *  requests for cgi-bin/livelog.cgi are rendered straight from the device
+ *  cache. A single thread handles every viewer with poll(), the scan loop
+ *  holds the cache lock whenever it is changing dev_cache.
+ *
+ *  Pages can also connect to /events, which is a Server-Sent Events stream
+ *  of table rows for devices as they are logged or seen again. The script
+ *  in www/live.js uses it to update the table in place instead of having
+ *  the whole page reload.
+ *
+ *  Metrics are at /metrics, in Prometheus text format.
+ */
+
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+// Size limits
+#define HTTP_MAX_CLIENTS 64
+#define HTTP_REQ_LEN 2048
+// Seconds before giving up on a client
+#define HTTP_TIMEOUT 10
+// Event stream buffer shared by all listeners, and keepalive interval
+#define HTTP_RING_SIZE 65536
+#define HTTP_PING 15
+
+// Connected viewer
+struct http_client
+{
+	int fd;
+	time_t start;
+
+	// Request so far
+	char request[HTTP_REQ_LEN];
+	int req_len;
+
+	// Response, sent once request is complete
+	char *response;
+	size_t resp_len;
+	size_t sent;
+
+	// Event stream listener, and how far into the ring it has read
+	int stream;
+	unsigned long event_pos;
+};
+
+// Global server state
+int http_listen = -1;
+pthread_t http_thread;
+struct http_client http_clients[HTTP_MAX_CLIENTS];
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Info box contents, filled in at startup
+char live_info[512];
+
+// Events waiting to go out, head only ever increases. Protected by the
+// cache lock, the wake pipe gets the server thread's attention.
+char http_ring[HTTP_RING_SIZE];
+unsigned long http_ring_head = 0;
+int http_wake[2] = { -1, -1 };
+
+// Scan loop holds this while changing dev_cache
+void cache_lock (void)
+{
+	pthread_mutex_lock(&cache_mutex);
+}
+
+void cache_unlock (void)
+{
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+// Guess content type from extension
+static const char* http_type (const char *path)
+{
+	const char *ext = strrchr(path, '.');
+
+	if (ext == NULL)
+		return("application/octet-stream");
+	if (!strcmp(ext, ".html"))
+		return("text/html");
+	if (!strcmp(ext, ".css"))
+		return("text/css");
+	if (!strcmp(ext, ".js"))
+		return("application/javascript");
+	if (!strcmp(ext, ".png"))
+		return("image/png");
+	if (!strcmp(ext, ".ico"))
+		return("image/x-icon");
+	return("application/octet-stream");
+}
+
+// Queue data for every event listener, cache lock must be held
+static void http_ring_add (const char *data, int len)
+{
+	unsigned long pos = http_ring_head % HTTP_RING_SIZE;
+	int first = (len < HTTP_RING_SIZE - pos) ? len : HTTP_RING_SIZE - pos;
+
+	memcpy(http_ring + pos, data, first);
+	memcpy(http_ring, data + first, len - first);
+	http_ring_head += len;
+}
+
+// Push row for device that was logged or seen again, called by the scan
+// loop with the cache lock held
+void http_event (struct btdev *dev)
+{
+	struct live_field fields[LIVE_FIELDS];
+	char event[2048];
+	FILE *out;
+	long start, len, i;
+
+	// Only devices that have been logged show up on the page
+	if (http_listen < 0 || dev->print != 0)
+		return;
+
+	// MAC first so the page can find the row, then the row itself
+	live_fields(dev - dev_cache, fields);
+	if ((out = fmemopen(event, sizeof(event), "w")) == NULL)
+		return;
+	fprintf(out, "event: device\ndata: %.*s\t", fields[1].len, fields[1].text);
+	start = ftell(out);
+	html_row(out, 0, fields);
+	len = ftell(out);
+	fclose(out);
+
+	// Row ends with a newline, data can't have any others
+	if (len <= start || len >= sizeof(event) - 1)
+		return;
+	for (i = start; i < len - 1; i++)
+		if (event[i] == '\r' || event[i] == '\n')
+			event[i] = ' ';
+	event[len++] = '\n';
+
+	http_ring_add(event, len);
+	if (write(http_wake[1], "", 1) < 0)
+		return;
+}
+
+// Table rows from device cache, newest first
+static void http_rows (FILE *out, int mobile)
+{
+	struct live_field fields[LIVE_FIELDS];
+	int i;
+
+	for (i = cache_index - 1; i >= 0; i--)
+	{
+		if (dev_cache[i].print != 0)
+			continue;
+		live_fields(i, fields);
+		html_row(out, mobile, fields);
+	}
+}
+
+// Same page livelog.cgi would make, but from memory
+static void http_page (FILE *out, int mobile)
+{
+	int i, count = 0;
+
+	// Only show devices that have been logged
+	cache_lock();
+	for (i = 0; i < cache_index; i++)
+		if (dev_cache[i].print == 0)
+			count++;
+
+	html_header(out, "../", mobile ? "mobile.css" : "style.css", APPNAME, VERSION);
+	if (!mobile)
+	{
+		fputs("<div id=\"container\">\n\n", out);
+		html_sidebar(out, live_info, strlen(live_info), 1, count);
+	}
+	else
+		html_topbar(out, count);
+
+	html_content(out, mobile, count, http_rows, NULL);
+	cache_unlock();
+}
+
+// Copy file into response body, returns non-zero if not found
+static int http_file (FILE *out, const char *path)
+{
+	char buffer[4096];
+	size_t len;
+	FILE *file;
+
+	if ((file = fopen(path, "r")) == NULL)
+		return(1);
+
+	while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		fwrite(buffer, 1, len, out);
+
+	fclose(file);
+	return(0);
+}
+
+// Build response for request line
+static void http_respond (struct http_client *client)
+{
+	char path[MAX_VALUE_LEN + HTTP_REQ_LEN];
+	char *method, *uri, *query, *body = NULL;
+	const char *type = "text/html";
+	const char *status = "200 OK";
+	size_t body_len = 0;
+	FILE *out;
+
+	// Method and path, ignore everything else
+	method = strtok(client->request, " \r\n");
+	uri = strtok(NULL, " \r\n");
+
+	out = open_memstream(&body, &body_len);
+	if (method == NULL || uri == NULL || (strcmp(method, "GET") && strcmp(method, "HEAD")))
+	{
+		status = "501 Not Implemented";
+		fputs("<html><body>Not Implemented</body></html>\n", out);
+	}
+	else
+	{
+		if ((query = strchr(uri, '?')) != NULL)
+			*query++ = '\0';
+
+		if (!strcmp(uri, "/"))
+			uri = "/index.html";
+
+		if (!strcmp(uri, "/events"))
+		{
+			// Headers only, events follow as they happen
+			client->response = strdup("HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/event-stream\r\n"
+				"Cache-Control: no-cache\r\n\r\n"
+				"retry: 5000\n\n");
+			client->resp_len = strlen(client->response);
+			client->stream = 1;
+			cache_lock();
+			client->event_pos = http_ring_head;
+			cache_unlock();
+			fclose(out);
+			free(body);
+			return;
+		}
+		else if (!strcmp(uri, "/metrics"))
+		{
+			type = "text/plain; version=0.0.4";
+			metrics_print(out);
+		}
+		else if (!strcmp(uri, "/cgi-bin/livelog.cgi"))
+			http_page(out, query != NULL && !strcmp(query, "-m"));
+		else
+		{
+			// Stay inside web root
+			snprintf(path, sizeof(path), "%s%s", config.http_root, uri);
+			type = http_type(path);
+			if (strstr(uri, "..") || http_file(out, path))
+			{
+				// Default theme if style.css wasn't linked at install
+				snprintf(path, sizeof(path), "%s/bluelog.css", config.http_root);
+				if (strcmp(uri, "/style.css") || http_file(out, path))
+				{
+					status = "404 Not Found";
+					type = "text/html";
+					fputs("<html><body>Not Found</body></html>\n", out);
+				}
+			}
+		}
+	}
+	fclose(out);
+
+	// Headers go out first, skip body for HEAD
+	out = open_memstream(&client->response, &client->resp_len);
+	fprintf(out, "HTTP/1.0 %s\r\n"
+		"Server: %s/%s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %lu\r\n"
+		"Cache-Control: no-cache\r\n"
+		"Connection: close\r\n\r\n",
+		status, APPNAME, VERSION, type, (unsigned long)body_len);
+	if (method == NULL || strcmp(method, "HEAD"))
+		fwrite(body, 1, body_len, out);
+	fclose(out);
+	free(body);
+}
+
+// Close connection and free slot
+static void http_drop (struct http_client *client)
+{
+	close(client->fd);
+	free(client->response);
+	memset(client, 0, sizeof(*client));
+	client->fd = -1;
+}
+
+// Take new connections
+static void http_accept (void)
+{
+	int i, fd;
+
+	while ((fd = accept(http_listen, NULL, NULL)) >= 0)
+	{
+		for (i = 0; i < HTTP_MAX_CLIENTS; i++)
+			if (http_clients[i].fd < 0)
+				break;
+
+		// Too busy, they can try again
+		if (i == HTTP_MAX_CLIENTS)
+		{
+			close(fd);
+			continue;
+		}
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		http_clients[i].fd = fd;
+		http_clients[i].start = time(NULL);
+	}
+}
+
+// Read request, returns non-zero if client should be dropped
+static int http_read (struct http_client *client)
+{
+	ssize_t len;
+
+	// Listeners have nothing more to say, just watch for hangup
+	if (client->stream)
+	{
+		len = recv(client->fd, client->request, HTTP_REQ_LEN, 0);
+		return(len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR));
+	}
+
+	len = recv(client->fd, client->request + client->req_len, HTTP_REQ_LEN - 1 - client->req_len, 0);
+	if (len == 0)
+		return(1);
+	if (len < 0)
+		return(!(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+
+	client->req_len += len;
+	client->request[client->req_len] = '\0';
+
+	// Respond once headers are done, or we've read all we'll take
+	if (strstr(client->request, "\r\n\r\n") || strstr(client->request, "\n\n") ||
+		client->req_len == HTTP_REQ_LEN - 1)
+		http_respond(client);
+
+	return(0);
+}
+
+// Send what we can, returns non-zero when done or on error
+static int http_write (struct http_client *client)
+{
+	ssize_t sent;
+
+	sent = send(client->fd, client->response + client->sent, client->resp_len - client->sent, MSG_NOSIGNAL);
+	if (sent < 0)
+		return(!(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+
+	client->sent += sent;
+	if (client->sent < client->resp_len)
+		return(0);
+
+	// Event listeners stay connected once the headers are out
+	free(client->response);
+	client->response = NULL;
+	return(!client->stream);
+}
+
+// Send queued events, returns non-zero if client should be dropped
+static int http_stream (struct http_client *client)
+{
+	unsigned long pos, len;
+	ssize_t sent;
+	int drop = 0;
+
+	cache_lock();
+
+	// Too far behind, the page will reload when it reconnects
+	if (http_ring_head - client->event_pos > HTTP_RING_SIZE)
+		drop = 1;
+
+	while (!drop && client->event_pos != http_ring_head)
+	{
+		// Send up to the end of the ring, wrap on next pass
+		pos = client->event_pos % HTTP_RING_SIZE;
+		len = http_ring_head - client->event_pos;
+		if (len > HTTP_RING_SIZE - pos)
+			len = HTTP_RING_SIZE - pos;
+
+		sent = send(client->fd, http_ring + pos, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0)
+		{
+			drop = !(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+			break;
+		}
+		client->event_pos += sent;
+	}
+
+	cache_unlock();
+	return(drop);
+}
+
+// Server thread
+static void* http_loop (void *arg)
+{
+	struct pollfd fds[HTTP_MAX_CLIENTS + 2];
+	struct http_client *polled[HTTP_MAX_CLIENTS + 2];
+	struct http_client *client;
+	int i, count, drop;
+	time_t now, last_ping = 0;
+	char wake[64];
+
+	for (;;)
+	{
+		// Listening socket, wake pipe, then everyone connected
+		fds[0].fd = http_listen;
+		fds[0].events = POLLIN;
+		fds[1].fd = http_wake[0];
+		fds[1].events = POLLIN;
+		count = 2;
+		for (i = 0; i < HTTP_MAX_CLIENTS; i++)
+		{
+			if (http_clients[i].fd < 0)
+				continue;
+			fds[count].fd = http_clients[i].fd;
+			fds[count].events = http_clients[i].response ? POLLOUT : POLLIN;
+			polled[count] = &http_clients[i];
+			count++;
+		}
+
+		if (poll(fds, count, 1000) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "Web server poll failed, stopping.");
+			break;
+		}
+
+		if (fds[0].revents & POLLIN)
+			http_accept();
+
+		// Just a nudge, new events get picked up below
+		if (fds[1].revents & POLLIN)
+			while (read(http_wake[0], wake, sizeof(wake)) > 0);
+
+		// Keep idle event streams from being closed by proxies
+		now = time(NULL);
+		if (now - last_ping >= HTTP_PING)
+		{
+			cache_lock();
+			http_ring_add(": ping\n\n", 8);
+			cache_unlock();
+			last_ping = now;
+		}
+
+		for (i = 2; i < count; i++)
+		{
+			client = polled[i];
+			drop = 0;
+
+			if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+				drop = 1;
+			else if (fds[i].revents & POLLIN)
+				drop = http_read(client);
+			else if (fds[i].revents & POLLOUT)
+				drop = http_write(client);
+
+			// Listeners get whatever is new
+			if (!drop && client->stream && client->response == NULL)
+				drop = http_stream(client);
+			// Don't let slow clients hold a slot forever
+			else if (!client->stream && (now - client->start) > HTTP_TIMEOUT)
+				drop = 1;
+
+			if (drop)
+				http_drop(client);
+		}
+	}
+
+	return(NULL);
+}
+
+// Open listening socket, the thread starts later from http_start(). Non-zero
+// with cfg_error set if it fails.
+int open_http_server (void)
+{
+	struct sockaddr_in adr_inet;
+	int i, on = 1;
+
+	if (!config.quiet)
+		printf("Starting web server on port %i...", config.http_port);
+
+	for (i = 0; i < HTTP_MAX_CLIENTS; i++)
+		http_clients[i].fd = -1;
+
+	memset(&adr_inet, 0, sizeof(adr_inet));
+	adr_inet.sin_family = AF_INET;
+	adr_inet.sin_port = htons(config.http_port);
+	adr_inet.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if ((http_listen = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		strcpy(cfg_error, "Error opening socket!");
+		return 1;
+	}
+
+	setsockopt(http_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(http_listen, (struct sockaddr *)&adr_inet, sizeof(adr_inet)) < 0 || listen(http_listen, 16) < 0)
+	{
+		snprintf(cfg_error, sizeof(cfg_error), "Error binding to port %i!", config.http_port);
+		close(http_listen);
+		http_listen = -1;
+		return 1;
+	}
+	fcntl(http_listen, F_SETFL, fcntl(http_listen, F_GETFL) | O_NONBLOCK);
+
+	// Scan loop pokes this when there are new events
+	if (pipe(http_wake) < 0)
+	{
+		strcpy(cfg_error, "Error creating wake pipe!");
+		close(http_listen);
+		http_listen = -1;
+		return 1;
+	}
+	fcntl(http_wake[0], F_SETFL, fcntl(http_wake[0], F_GETFL) | O_NONBLOCK);
+	fcntl(http_wake[1], F_SETFL, fcntl(http_wake[1], F_GETFL) | O_NONBLOCK);
+
+	if (!config.quiet)
+		printf("OK\n");
+	return 0;
+}
+
+// Serve from the socket opened above, once the process won't fork again
+void http_start (void)
+{
+	sigset_t all, old;
+
+	if (http_listen < 0)
+		return;
+
+	// Leave signals for the main thread
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	if (pthread_create(&http_thread, NULL, http_loop, NULL))
+		syslog(LOG_ERR,"Unable to start web server thread!");
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
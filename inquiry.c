@@ -0,0 +1,184 @@
+/*
+ *  inquiry.c - Inquiry that doesn't block
+ *
+ *  hci_inquiry() sits in the kernel for the whole scan window and hands
+ *  back every result at the end. Instead we send the Inquiry command on a
+ *  raw HCI socket of our own and read results as the adapter reports them,
+ *  so the event loop can handle each device as soon as it is found and
+ *  stays free for everything else in between.
+ *
+ *  Adapters report in one of three formats depending on their inquiry
+ *  mode (standard, with RSSI, or extended), all are accepted. A device can
+ *  be reported more than once per inquiry, only the first one is passed on.
+ */
+
+// Most devices reported per inquiry, as with hci_inquiry()
+#define INQUIRY_MAX 255
+
+// General inquiry access code
+static const uint8_t inquiry_giac[3] = { 0x33, 0x8b, 0x9e };
+
+// Socket that gets inquiry events, for the event loop
+int inquiry_socket = -1;
+
+// Inquiry in progress and when it started
+int inquiry_running = 0;
+double inquiry_started;
+
+// Devices already reported during this inquiry
+static bdaddr_t inquiry_seen[INQUIRY_MAX];
+static int inquiry_count;
+
+// Open own socket for inquiry, returns non-zero on failure
+int inquiry_open (int device)
+{
+	struct hci_filter filter;
+
+	if ((inquiry_socket = hci_open_dev(device)) < 0)
+		return(1);
+
+	// Only the events we handle, nothing else queues up on this socket
+	hci_filter_clear(&filter);
+	hci_filter_set_ptype(HCI_EVENT_PKT, &filter);
+	hci_filter_set_event(EVT_CMD_STATUS, &filter);
+	hci_filter_set_event(EVT_INQUIRY_RESULT, &filter);
+	hci_filter_set_event(EVT_INQUIRY_RESULT_WITH_RSSI, &filter);
+	hci_filter_set_event(EVT_EXTENDED_INQUIRY_RESULT, &filter);
+	hci_filter_set_event(EVT_INQUIRY_COMPLETE, &filter);
+	if (setsockopt(inquiry_socket, SOL_HCI, HCI_FILTER, &filter, sizeof(filter)) < 0)
+	{
+		close(inquiry_socket);
+		inquiry_socket = -1;
+		return(1);
+	}
+
+	fcntl(inquiry_socket, F_SETFL, fcntl(inquiry_socket, F_GETFL) | O_NONBLOCK);
+	return(0);
+}
+
+// Start inquiry of length * 1.28 seconds, returns non-zero on failure
+int inquiry_start (int length)
+{
+	inquiry_cp cp;
+
+	memcpy(cp.lap, inquiry_giac, sizeof(cp.lap));
+	cp.length = length;
+	cp.num_rsp = INQUIRY_MAX;
+
+	inquiry_count = 0;
+	inquiry_started = metrics_now();
+	PROBE(inquiry__start);
+	if (hci_send_cmd(inquiry_socket, OGF_LINK_CTL, OCF_INQUIRY, INQUIRY_CP_SIZE, &cp) < 0)
+		return(1);
+
+	inquiry_running = 1;
+	return(0);
+}
+
+// Stop inquiry early
+void inquiry_cancel (void)
+{
+	if (inquiry_running)
+		hci_send_cmd(inquiry_socket, OGF_LINK_CTL, OCF_INQUIRY_CANCEL, 0, NULL);
+	inquiry_running = 0;
+}
+
+// Add result unless it was already reported this inquiry
+static void inquiry_add (inquiry_info *results, int *num, const bdaddr_t *bdaddr, const uint8_t *dev_class)
+{
+	int i;
+
+	for (i = 0; i < inquiry_count; i++)
+		if (!bacmp(&inquiry_seen[i], bdaddr))
+			return;
+	if (inquiry_count == INQUIRY_MAX)
+		return;
+	bacpy(&inquiry_seen[inquiry_count++], bdaddr);
+
+	memset(&results[*num], 0, sizeof(inquiry_info));
+	bacpy(&results[*num].bdaddr, bdaddr);
+	memcpy(results[*num].dev_class, dev_class, 3);
+	(*num)++;
+}
+
+// Read everything waiting on the socket. New results go into results, which
+// must hold INQUIRY_MAX. Returns how many, status is set to 1 once the
+// inquiry is finished, -1 if it failed.
+int inquiry_read (inquiry_info *results, int *status)
+{
+	unsigned char buf[HCI_MAX_EVENT_SIZE];
+	hci_event_hdr *hdr = (hci_event_hdr*)(buf + 1);
+	unsigned char *ptr = buf + 1 + HCI_EVENT_HDR_SIZE;
+	evt_cmd_status *cs;
+	int len, num = 0, i, count;
+
+	*status = 0;
+	while ((len = read(inquiry_socket, buf, sizeof(buf))) > 0)
+	{
+		if (len < 1 + HCI_EVENT_HDR_SIZE || buf[0] != HCI_EVENT_PKT || len < 1 + HCI_EVENT_HDR_SIZE + hdr->plen)
+			continue;
+		count = hdr->plen ? ptr[0] : 0;
+
+		switch (hdr->evt)
+		{
+		case EVT_CMD_STATUS:
+			cs = (evt_cmd_status*)ptr;
+			if (btohs(cs->opcode) == cmd_opcode_pack(OGF_LINK_CTL, OCF_INQUIRY) && cs->status)
+				*status = -1;
+			break;
+		case EVT_INQUIRY_RESULT:
+			for (i = 0; i < count && 1 + (i + 1) * INQUIRY_INFO_SIZE <= hdr->plen; i++)
+			{
+				inquiry_info *info = (inquiry_info*)(ptr + 1 + i * INQUIRY_INFO_SIZE);
+				inquiry_add(results, &num, &info->bdaddr, info->dev_class);
+			}
+			break;
+		case EVT_INQUIRY_RESULT_WITH_RSSI:
+			for (i = 0; i < count && 1 + (i + 1) * INQUIRY_INFO_WITH_RSSI_SIZE <= hdr->plen; i++)
+			{
+				inquiry_info_with_rssi *info = (inquiry_info_with_rssi*)(ptr + 1 + i * INQUIRY_INFO_WITH_RSSI_SIZE);
+				inquiry_add(results, &num, &info->bdaddr, info->dev_class);
+			}
+			break;
+		case EVT_EXTENDED_INQUIRY_RESULT:
+			if (1 + EXTENDED_INQUIRY_INFO_SIZE <= hdr->plen)
+			{
+				extended_inquiry_info *info = (extended_inquiry_info*)(ptr + 1);
+				inquiry_add(results, &num, &info->bdaddr, info->dev_class);
+			}
+			break;
+		case EVT_INQUIRY_COMPLETE:
+			*status = (hdr->plen && ptr[0]) ? -1 : 1;
+			break;
+		}
+
+		if (*status)
+		{
+			inquiry_running = 0;
+			break;
+		}
+	}
+
+	// Socket itself went bad
+	if (len < 0 && errno != EAGAIN && errno != EINTR)
+	{
+		inquiry_running = 0;
+		*status = -1;
+	}
+	return(num);
+}
+
+// Results so far this inquiry
+int inquiry_results (void)
+{
+	return(inquiry_count);
+}
+
+void inquiry_close (void)
+{
+	if (inquiry_socket < 0)
+		return;
+	inquiry_cancel();
+	close(inquiry_socket);
+	inquiry_socket = -1;
+}
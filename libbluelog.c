@@ -0,0 +1,1518 @@
+/*
+ *  libbluelog - Scanner, device cache and outputs behind Bluelog
+ * 
+ *  Everything but the command line: inquiry, name requests, the device
+ *  cache, every output mode, and the event loop that drives them. The
+ *  bluelog command (bluelog.c) is a client of this, so is anything else
+ *  that wants to embed a scanner. See libbluelog.h for the API.
+ * 
+ *  Bluelog uses code from a number of GPL projects. See README for more info.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+
+// Load configuration
+#include "config.h"
+
+// Tracepoints, no-ops unless built with sys/sdt.h
+#include "probes.h"
+
+// Public API
+#include "libbluelog.h"
+
+// Bluelog-specific includes
+#include "classes.c"
+#include "libmackerel.c"
+#include "readconfig.c"
+#include "metrics.c"
+#include "udp.c"
+#include "inquiry.c"
+#include "live.h"
+#include "livehtml.c"
+
+// Found device struct
+struct btdev
+{
+	char name[248];
+	char addr[18];
+	char priv_addr[18];
+	bdaddr_t bdaddr;
+	char time[20];
+	uint64_t epoch;
+	uint64_t last_seen;
+	uint8_t flags;
+	uint8_t major_class;
+	uint8_t minor_class;
+	uint8_t print;
+	uint8_t seen;
+	uint8_t gone;
+	uint64_t session_start;
+	uint32_t sightings;
+	uint32_t sessions;
+	double dwell_mean;
+	double dwell_m2;
+};
+
+// Global variables
+FILE *outfile; // Output file
+FILE *infofile; // Status file
+int live_idx = -1; // Live log index
+struct live_idx_header live_header; // Copy of index header
+uint64_t live_idx_epoch = 0; // Newest write time in live index
+uint32_t live_compacted = 0; // Records in live log after last compaction
+inquiry_info *results; // BlueZ scan results struct
+			
+struct btdev dev_cache[MAX_DEV]; // Init device cache
+int cache_index = 0; // Next free slot in device cache
+uint32_t cache_generation = 0; // Times device cache has been reset
+int error_count = 0; // Back to back BlueZ errors
+
+// Time to scan. Scan time is roughly 1.28 seconds * scan_window
+// Originally this was always 8, now we adjust based on device:
+#ifdef OPENWRT
+int scan_window = 8;
+#elif PWNPLUG
+int scan_window = 5;
+#else
+int scan_window = 3;
+#endif
+
+// Library context. All the state above is global, so there's only one.
+struct bluelog
+{
+	bluelog_cb cb;
+	int events;
+	void *data;
+	int device;
+	int failed;
+	char *outfilename;
+	char started[20];
+	char error[128];
+};
+static struct bluelog *instance = NULL;
+
+// Scan can't go on, bluelog_poll() reports it from now on
+static void scan_fail (const char *error)
+{
+	instance->failed = 1;
+	snprintf(instance->error, sizeof(instance->error), "%s", error);
+}
+
+// Subscriber socket needs struct btdev
+#include "unixsock.c"
+
+// Device event for subscribers and the program embedding us
+static void notify (int event, struct btdev *dev)
+{
+	struct bluelog_device device;
+	
+	sock_event(event, dev);
+	if (instance->cb == NULL || !(instance->events & event))
+		return;
+	
+	device.addr = dev->addr;
+	device.name = dev->name;
+	device.time = dev->time;
+	memcpy(device.bdaddr, dev->bdaddr.b, sizeof(device.bdaddr));
+	device.flags = dev->flags;
+	device.major_class = dev->major_class;
+	device.minor_class = dev->minor_class;
+	device.seen = dev->seen;
+	device.last_seen = dev->last_seen;
+	device.session_start = dev->session_start;
+	device.sightings = dev->sightings;
+	device.sessions = dev->sessions;
+	device.dwell_mean = dev->dwell_mean;
+	instance->cb(instance, event, &device, instance->data);
+}
+
+// Fields for Bluelog Live, shared by log and web server
+void live_fields(int index, struct live_field *fields)
+{
+	// Local variables, all point to constant strings
+	const char *local_name;
+	const char *local_class;
+	const char *local_capabilities;
+	
+	//Populate the local variables
+	local_name = dev_cache[index].name;
+	local_class = device_class(dev_cache[index].major_class, dev_cache[index].minor_class);
+	local_capabilities = device_capability(dev_cache[index].flags);
+		
+	// Let's format these a little nicer
+	if (!strcmp(local_name, "VOID"))
+		local_name = "No Response";
+	if (!strcmp(local_class, "VOID"))
+		local_class = "Unclassified";
+	if (!strcmp(local_capabilities, "VOID"))
+		local_capabilities = "Not Reported";
+	
+	fields[0] = live_string(dev_cache[index].time);
+	fields[1] = live_string(dev_cache[index].addr);
+	fields[2] = live_string(local_name);
+	fields[3] = live_string(local_class);
+	
+	// Last field is variable
+	if (config.getmanufacturer)
+		fields[4] = live_string(mac_get_vendor_r(&dev_cache[index].bdaddr));
+	else
+		fields[4] = live_string(local_capabilities);
+}
+
+// Web server and shared memory need live_fields()
+#include "httpd.c"
+#include "liveshm.c"
+
+// Name and output threads need outfile
+#include "pipeline.c"
+
+char* get_localtime()
+{
+	// Time variables
+	time_t rawtime;
+	struct tm * timeinfo;
+	static char time_string[20];
+	
+	// Find time and put it into time_string
+	time (&rawtime);
+	timeinfo = localtime(&rawtime);
+	strftime(time_string,20,"%D %T",timeinfo);
+	
+	// Send it back
+	return(time_string);
+}
+
+char* file_timestamp()
+{
+	// Time variables
+	time_t rawtime;
+	struct tm * timeinfo;
+	static char time_string[20];
+	static char filename[40];
+	
+	// Find time and put it into time_string
+	time (&rawtime);
+	timeinfo = localtime(&rawtime);
+	strftime(time_string,20,"%F-%H%M",timeinfo);
+	
+	sprintf(filename,"bluelog-%s.log",time_string);
+	
+	// Send it back
+	return(filename);
+}
+
+// Visible MAC, encoded or obfuscated if enabled. Set when the device goes
+// in the cache, so nothing outside ever sees the real one.
+void encode_addr (struct btdev *dev)
+{
+	char addr_buff[19] = {0};
+	long long int epoch;
+	
+	if (!config.encode && !config.obfuscate)
+	{
+		strcpy(dev->addr, dev->priv_addr);
+		return;
+	}
+	
+	if (config.obfuscate)
+		mac_obfuscate_r(&dev->bdaddr, addr_buff);
+	
+	if (config.encode && config.keyed)
+	{
+		// Key changes every rotation period, if set
+		epoch = config.key_rotate ? time(NULL) / (config.key_rotate * 60) : 0;
+		mac_keyed_r(&dev->bdaddr, epoch, addr_buff);
+	}
+	else if (config.encode)
+		mac_encode_r(&dev->bdaddr, addr_buff);
+
+	// Copy to cache
+	strcpy(dev->addr, addr_buff);
+}
+
+// Config reload waits until the current inquiry is done
+int reload_pending = 0;
+
+// Re-read config file between scans. New config is checked and its outputs
+// opened before anything is changed, if any of it fails the old one stays.
+void reload_config (void)
+{
+	struct cfg new_config = cfg_defaults;
+	FILE *new_outfile = outfile;
+	int file_out, old_socket, ri;
+	
+	reload_pending = 0;
+	
+	if (!cfg_from_file)
+	{
+		syslog(LOG_INFO, "Started with command line options, nothing to reload.");
+		return;
+	}
+	
+	if (cfg_load(&new_config) != 0)
+		goto rejected;
+	
+	// Set up once at startup, these only change on restart
+	new_config.quiet = config.quiet;
+	new_config.daemon = config.daemon;
+	new_config.bluelive = config.bluelive;
+	new_config.bluepropro = config.bluepropro;
+	new_config.getmanufacturer = config.getmanufacturer;
+	new_config.hci_device = config.hci_device;
+	new_config.pipeline = config.pipeline;
+	strcpy(new_config.pipeline_cpus, config.pipeline_cpus);
+	new_config.unixsock = config.unixsock;
+	new_config.http_port = config.http_port;
+	strcpy(new_config.http_root, config.http_root);
+	new_config.outfilename = config.outfilename;
+	new_config.bt_socket = config.bt_socket;
+	new_config.udp_socket = config.udp_socket;
+	strcpy(new_config.addr, config.addr);
+	
+	if (cfg_validate(&new_config))
+		goto rejected;
+	
+	// Checks above turn off Live and BPP if new output mode clashes
+	if (new_config.bluelive != config.bluelive || new_config.bluepropro != config.bluepropro)
+	{
+		strcpy(cfg_error, "Output mode can't change in Live or BlueProPro mode.");
+		goto rejected;
+	}
+	
+	// Reopen log file if we are going back to it
+	file_out = !new_config.syslogonly && !new_config.udponly;
+	if (file_out && outfile == NULL && (new_outfile = fopen(config.outfilename, "a+")) == NULL)
+	{
+		snprintf(cfg_error, sizeof(cfg_error), "Error opening output file %s!", config.outfilename);
+		goto rejected;
+	}
+	
+	old_socket = config.udp_socket;
+	if (new_config.udponly && udp_reload(&new_config))
+	{
+		if (new_outfile != outfile)
+			fclose(new_outfile);
+		goto rejected;
+	}
+	
+	// Nothing can fail from here on, sink thread has to be
+	// done with the old outputs first
+	pipeline_drain();
+	if (!file_out && outfile != NULL)
+	{
+		fclose(outfile);
+		new_outfile = NULL;
+	}
+	outfile = new_outfile;
+	
+	if (!new_config.udponly && old_socket >= 0)
+	{
+		if (config.hangup)
+			send_udp_msg("Disconnect\n");
+		close(old_socket);
+		new_config.udp_socket = -1;
+	}
+	
+	if (new_config.keyed)
+		mac_key_set(new_config.encode_key);
+	
+	config = new_config;
+	
+	// Cached devices go out with the new MAC settings from now on
+	for (ri = 0; ri < cache_index; ri++)
+		encode_addr(&dev_cache[ri]);
+	
+	syslog(LOG_INFO, "Configuration reloaded from %s.", CFG_FILE);
+	return;
+	
+rejected:
+	syslog(LOG_ERR, "Configuration reload failed, keeping old settings: %s", cfg_error);
+}
+
+// Start new index for live log, non-zero with cfg_error set if it fails
+int live_index_open (void)
+{
+	struct stat st;
+	
+	if (!config.quiet)
+		printf("Opening index file: %s...", LIVE_IDX);
+	
+	if ((live_idx = open(LIVE_IDX, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		strcpy(cfg_error, "Error opening index file!");
+		return(1);
+	}
+	
+	memset(&live_header, 0, sizeof(live_header));
+	strcpy(live_header.magic, LIVE_IDX_MAGIC);
+	live_header.version = LIVE_IDX_VERSION;
+	if (outfile != NULL && fstat(fileno(outfile), &st) == 0)
+		live_header.log_id = st.st_ino;
+	
+	if (pwrite(live_idx, &live_header, sizeof(live_header), 0) != sizeof(live_header))
+	{
+		strcpy(cfg_error, "Error writing index file!");
+		return(1);
+	}
+	
+	if (!config.quiet)
+		printf("OK\n");
+	return(0);
+}
+
+// Add record that starts at offset, must already be flushed to log
+void live_index_add (long offset, uint64_t epoch)
+{
+	struct live_idx_entry entry;
+	off_t position;
+	
+	if (live_idx < 0)
+		return;
+	
+	// Readers binary search on write time, so it never goes backwards,
+	// even if the clock does
+	if (epoch < live_idx_epoch)
+		epoch = live_idx_epoch;
+	live_idx_epoch = epoch;
+	
+	entry.offset = offset;
+	entry.epoch = epoch;
+	position = sizeof(live_header) + (off_t)live_header.count * sizeof(entry);
+	
+	// Entry goes out first, count only covers finished entries
+	if (pwrite(live_idx, &entry, sizeof(entry), position) != sizeof(entry))
+	{
+		syslog(LOG_ERR,"Unable to write live index, disabling it.");
+		close(live_idx);
+		live_idx = -1;
+		unlink(LIVE_IDX);
+		return;
+	}
+	
+	live_header.count++;
+	live_header.log_size = ftell(outfile);
+	if (pwrite(live_idx, &live_header, sizeof(live_header), 0) != sizeof(live_header))
+		syslog(LOG_ERR,"Unable to update live index header!");
+}
+
+void live_entry(int index)
+{
+	// Where this record starts
+	long offset = ftell(outfile);
+	struct live_field fields[LIVE_FIELDS];
+	double start;
+	int i;
+	
+	// Write out log
+	live_fields(index, fields);
+	for (i = 0; i < LIVE_FIELDS; i++)
+		fprintf(outfile,"%.*s%c", fields[i].len, fields[i].text, (i < LIVE_FIELDS - 1) ? ',' : '\n');
+	
+	// Record has to be in the log before the index points at it
+	PROBE2(emit, &dev_cache[index].bdaddr, PROBE_SINK_LIVE);
+	start = metrics_now();
+	PROBE(flush__start);
+	fflush(outfile);
+	PROBE(flush__done);
+	metrics_observe(H_FLUSH_TIME, metrics_now() - start);
+	metrics_add(M_BYTES_FILE, ftell(outfile) - offset);
+	live_index_add(offset, time(NULL));
+}
+
+// Find MAC field of record, returns non-zero if record is damaged
+static int live_record_mac (const char *log, uint64_t size, uint64_t offset, const char **mac, int *len)
+{
+	const char *start, *stop;
+	
+	if (offset >= size || (start = memchr(log + offset, ',', size - offset)) == NULL)
+		return(1);
+	start++;
+	if ((stop = memchr(start, ',', log + size - start)) == NULL)
+		return(1);
+	
+	*mac = start;
+	*len = stop - start;
+	return(0);
+}
+
+// Write kept records to new log and index, returns non-zero on failure
+static int live_compact_write (const struct live_idx_entry *entries, uint32_t count,
+	const char *log, uint64_t size, const char *keep, struct live_idx_header *header)
+{
+	struct live_idx_entry entry;
+	struct stat st;
+	const char *record, *end;
+	uint64_t last = 0;
+	size_t len;
+	uint32_t i;
+	FILE *out;
+	int fd, error = 0;
+	
+	if ((out = fopen(LIVE_OUT ".new", "w")) == NULL)
+		return(1);
+	if ((fd = open(LIVE_IDX ".new", O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		fclose(out);
+		return(1);
+	}
+	
+	memset(header, 0, sizeof(*header));
+	strcpy(header->magic, LIVE_IDX_MAGIC);
+	header->version = LIVE_IDX_VERSION;
+	if (fstat(fileno(out), &st) == 0)
+		header->log_id = st.st_ino;
+	
+	for (i = 0; i < count && !error; i++)
+	{
+		if (!keep[i])
+			continue;
+		
+		// Whole record, newline included
+		record = log + entries[i].offset;
+		if ((end = memchr(record, '\n', log + size - record)) == NULL)
+			end = log + size - 1;
+		len = end - record + 1;
+		
+		// Keep times in order for readers, older logs might not have them
+		entry.offset = ftell(out);
+		entry.epoch = (entries[i].epoch > last) ? entries[i].epoch : last;
+		last = entry.epoch;
+		if (fwrite(record, 1, len, out) != len ||
+			pwrite(fd, &entry, sizeof(entry), sizeof(*header) + (off_t)header->count * sizeof(entry)) != sizeof(entry))
+			error = 1;
+		header->count++;
+	}
+	
+	if (fflush(out) != 0)
+		error = 1;
+	header->log_size = ftell(out);
+	if (pwrite(fd, header, sizeof(*header), 0) != sizeof(*header))
+		error = 1;
+	
+	fclose(out);
+	close(fd);
+	return(error);
+}
+
+// Rewrite live log keeping only the newest record for each device, so it
+// doesn't grow forever when devices keep getting logged again
+void live_compact (void)
+{
+	struct live_idx_entry *entries;
+	struct live_idx_header header;
+	const char *mac, *other;
+	char *log, *keep;
+	uint32_t count = live_header.count, kept = 0, i, mask;
+	uint64_t size = live_header.log_size, hash;
+	int *table, fd, len, other_len, j;
+	
+	// Everything logged so far
+	fflush(outfile);
+	for (mask = 1; mask < count * 2; mask <<= 1);
+	entries = malloc(count * sizeof(*entries));
+	log = malloc(size);
+	keep = calloc(count, 1);
+	table = calloc(mask, sizeof(int));
+	mask--;
+	
+	fd = open(LIVE_OUT, O_RDONLY);
+	if (entries == NULL || log == NULL || keep == NULL || table == NULL || fd < 0 ||
+		pread(live_idx, entries, count * sizeof(*entries), sizeof(live_header)) != count * sizeof(*entries) ||
+		pread(fd, log, size, 0) != size)
+	{
+		syslog(LOG_ERR,"Unable to read live log for compaction!");
+		count = 0;
+	}
+	if (fd >= 0)
+		close(fd);
+	
+	// Newest first, keep a record only if its MAC hasn't come up yet.
+	// Table holds record number + 1, zero is empty.
+	for (i = count; i-- > 0;)
+	{
+		if (live_record_mac(log, size, entries[i].offset, &mac, &len))
+			continue;
+		
+		// FNV-1a
+		for (hash = 14695981039346656037ULL, j = 0; j < len; j++)
+			hash = (hash ^ (unsigned char)mac[j]) * 1099511628211ULL;
+		
+		for (hash &= mask; table[hash]; hash = (hash + 1) & mask)
+		{
+			live_record_mac(log, size, entries[table[hash] - 1].offset, &other, &other_len);
+			if (other_len == len && !memcmp(mac, other, len))
+				break;
+		}
+		if (table[hash])
+			continue;
+		
+		table[hash] = i + 1;
+		keep[i] = 1;
+		kept++;
+	}
+	
+	// Log goes first, readers that get the old index with it will notice
+	if (count == 0 || live_compact_write(entries, count, log, size, keep, &header) ||
+		rename(LIVE_OUT ".new", LIVE_OUT) < 0 || rename(LIVE_IDX ".new", LIVE_IDX) < 0)
+	{
+		if (count)
+			syslog(LOG_ERR,"Unable to compact live log!");
+		unlink(LIVE_OUT ".new");
+		unlink(LIVE_IDX ".new");
+		
+		// Don't try again until it's grown as much again
+		live_compacted = live_header.count;
+	}
+	else
+	{
+		syslog(LOG_INFO,"Compacted live log from %u to %u records.", count, kept);
+		
+		// Carry on with the new files
+		fclose(outfile);
+		close(live_idx);
+		if ((outfile = fopen(LIVE_OUT, "a")) == NULL || (live_idx = open(LIVE_IDX, O_RDWR)) < 0)
+		{
+			syslog(LOG_ERR,"Unable to reopen live log after compaction!");
+			printf("Unable to reopen live log after compaction!\n");
+			live_idx = -1;
+			scan_fail("Unable to reopen live log after compaction!");
+		}
+		live_header = header;
+		live_compacted = header.count;
+	}
+	
+	free(entries);
+	free(log);
+	free(keep);
+	free(table);
+}
+
+char* namequery (const bdaddr_t *addr)
+{
+	// Response to pass back
+	static char name[248];
+	
+	// Attempt to read device name, this can take a while so let
+	// the web server have the cache in the meantime
+	cache_unlock();
+	name_request(config.bt_socket, addr, name);
+	cache_lock();
+		
+	return (name);
+}
+
+// Write out device in cache slot ri to whatever outputs are enabled
+void log_device (int ri)
+{
+	// String to hold output line
+	char outbuffer[500];
+	
+	// Outputs might be gone after a failure
+	if (instance->failed)
+		return;
+	
+	// Keyed encoding changes every rotation period
+	if (config.keyed && config.key_rotate)
+		encode_addr(&dev_cache[ri]);
+	
+	// Print everything to console if verbose is on, optionally friendly class info
+	if (config.verbose)
+	{
+		if (config.friendlyclass)
+		{
+			printf("[%s] %s,%s,%s,(%s)\n",\
+				dev_cache[ri].time, dev_cache[ri].addr,\
+				dev_cache[ri].name, device_class(dev_cache[ri].major_class,\
+				dev_cache[ri].minor_class), device_capability(dev_cache[ri].flags));						
+		}
+		else
+		{
+			printf("[%s] %s,%s,0x%02x%02x%02x\n",\
+				dev_cache[ri].time, dev_cache[ri].addr,\
+				dev_cache[ri].name, dev_cache[ri].flags,\
+				dev_cache[ri].major_class, dev_cache[ri].minor_class);
+		}
+	}
+							
+	if (config.bluelive)
+	{
+		// Write result with live function
+		live_entry(ri);
+	}
+	else if (config.bluepropro)
+	{
+		// Set output format for BlueProPro
+		PROBE2(emit, &dev_cache[ri].bdaddr, PROBE_SINK_BPP);
+		metrics_add(M_BYTES_FILE, fprintf(outfile,"%s,0x%02x%02x%02x,%s\n",\
+			dev_cache[ri].addr, dev_cache[ri].flags, dev_cache[ri].major_class,\
+			dev_cache[ri].minor_class, dev_cache[ri].name));
+	}
+	else 
+	{
+		// Flush buffer
+		memset(outbuffer, 0, sizeof(outbuffer));
+		
+		// Print time first if enabled
+		if (config.showtime)
+			sprintf(outbuffer,"[%s],", dev_cache[ri].time);
+			
+		// Always output MAC
+		sprintf(outbuffer+strlen(outbuffer),"%s", dev_cache[ri].addr);
+		
+		// Optionally output class
+		if (config.showclass)					
+			sprintf(outbuffer+strlen(outbuffer),",0x%02x%02x%02x", dev_cache[ri].flags,\
+			dev_cache[ri].major_class, dev_cache[ri].minor_class);
+			
+		// "Friendly" version of class info
+		if (config.friendlyclass)					
+			sprintf(outbuffer+strlen(outbuffer),",%s,(%s)",\
+			device_class(dev_cache[ri].major_class, dev_cache[ri].minor_class),\
+			device_capability(dev_cache[ri].flags));
+		
+		// Get manufacturer
+		if (config.getmanufacturer)
+			sprintf(outbuffer+strlen(outbuffer),",%s", mac_get_vendor_r(&dev_cache[ri].bdaddr));
+			
+		// Append the name
+		if (config.getname)
+			sprintf(outbuffer+strlen(outbuffer),",%s", dev_cache[ri].name);
+									
+		// Send buffer, sink thread does it in pipeline mode
+		if (pipeline_sink)
+			pipeline_sink_push(&dev_cache[ri].bdaddr, outbuffer);
+		else
+			sink_write(&dev_cache[ri].bdaddr, outbuffer);
+	}
+	
+	// Tell subscribers
+	notify(EV_NEW, &dev_cache[ri]);
+	
+	dev_cache[ri].print = 0;
+	http_event(&dev_cache[ri]);
+	live_shm_device(ri);
+}
+
+// Queue name request for cache slot ri, returns non-zero if it has to be
+// done inline instead. If the queue is full it waits in the cache (print 5)
+// and goes in later, so the scan loop never waits on a name.
+int name_queue (int ri)
+{
+	if (!config.pipeline || !pipeline_names)
+		return(1);
+	
+	if (pipeline_name_push(ri, dev_cache[ri].seen > 1, cache_generation, &dev_cache[ri].bdaddr))
+		dev_cache[ri].print = 5;
+	else
+		dev_cache[ri].print = 4;
+	return(0);
+}
+
+// Names that came back from the pipeline since the last scan
+void name_replies (void)
+{
+	struct name_reply reply;
+	struct btdev *dev;
+	int ri;
+	
+	while (!pipeline_name_reply(&reply))
+	{
+		// Cache might have been reset since it was asked for
+		dev = &dev_cache[reply.slot];
+		if (reply.generation != cache_generation || dev->print != 4 || bacmp(&reply.bdaddr, &dev->bdaddr))
+			continue;
+		
+		strcpy(dev->name, reply.name);
+		if (reply.ok)
+		{
+			if (reply.retry)
+				syslog(LOG_INFO,"Name retry for %s successful!", dev->priv_addr);
+			log_device(reply.slot);
+		}
+		else
+		{
+			if (reply.retry)
+				syslog(LOG_INFO,"Name retry %i for %s failed!", dev->seen, dev->priv_addr);
+			else
+				syslog(LOG_INFO,"Device %s discovered with no name, will retry", dev->priv_addr);
+			dev->print = 3;
+		}
+	}
+	
+	// Room again for any that didn't fit
+	for (ri = 0; ri < cache_index; ri++)
+	{
+		if (dev_cache[ri].print != 5)
+			continue;
+		name_queue(ri);
+		if (dev_cache[ri].print == 5)
+			break;
+	}
+}
+
+// If there's a file open and nobody else is writing it, write changes
+void flush_output (void)
+{
+	double start;
+	
+	if (outfile == NULL || pipeline_sink)
+		return;
+	
+	start = metrics_now();
+	PROBE(flush__start);
+	fflush(outfile);
+	PROBE(flush__done);
+	metrics_observe(H_FLUSH_TIME, metrics_now() - start);
+}
+
+// Sessions write through the same outputs as devices
+#include "sessions.c"
+
+// Event loop and what it watches besides the inquiry socket
+int loop_fd = -1;
+int loop_timer = -1;
+
+static int loop_add (int fd)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+	
+	return(fd >= 0 && epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &event) < 0);
+}
+
+// Timer and eventfd reads are always a count, which we don't need
+static void loop_clear (int fd)
+{
+	uint64_t count;
+	
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		syslog(LOG_ERR,"Unable to read event count!");
+}
+
+// Signals are left to the program, loop_timer ticks once a second.
+// Returns non-zero on failure.
+int loop_open (void)
+{
+	struct itimerspec tick = { { 1, 0 }, { 1, 0 } };
+	
+	if ((loop_fd = epoll_create1(0)) < 0 ||
+		(loop_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0 ||
+		timerfd_settime(loop_timer, 0, &tick, NULL) < 0 ||
+		loop_add(inquiry_socket) || loop_add(loop_timer) ||
+		loop_add(sock_listen) || loop_add(pipeline_reply_wake))
+	{
+		syslog(LOG_ERR,"Unable to set up event loop!");
+		return(1);
+	}
+	
+	sock_loop = loop_fd;
+	return(0);
+}
+
+// One batch of results from the inquiry socket
+void handle_results (int num_results)
+{
+	int i, ri, pending;
+	long long int epoch;
+	
+	// Check if we need to reset device cache
+	if ((cache_index + num_results) >= MAX_DEV)
+	{
+		syslog(LOG_INFO,"Resetting device cache...");
+		metrics_add(M_CACHE_RESETS, 1);
+		metrics_add(M_CACHE_EVICTIONS, cache_index);
+		sessions_close_all();
+		memset(dev_cache, 0, sizeof(dev_cache));
+		cache_index = 0;
+		cache_generation++;
+		live_shm_reset();
+	}
+		
+	// Loop through results
+	for (i = 0; i < num_results; i++)
+	{	
+		// Compare to device cache, in binary so we only need
+		// to format the MAC for new devices
+		for (ri = 0; ri <= cache_index; ri++)
+		{				
+			// Determine if device is already logged
+			if (dev_cache[ri].addr[0] != '\0' && bacmp(&(results+i)->bdaddr, &dev_cache[ri].bdaddr) == 0)
+			{		
+				// This device has been seen before
+				PROBE2(result__seen, &dev_cache[ri].bdaddr, ri);
+				metrics_add(M_DEVICES_REPEAT, 1);
+		
+				// Increment seen count, update printed time
+				dev_cache[ri].seen++;
+				strcpy(dev_cache[ri].time, get_localtime());
+				dev_cache[ri].last_seen = time(NULL);
+				session_seen(&dev_cache[ri], dev_cache[ri].last_seen);
+				notify(EV_SEEN, &dev_cache[ri]);
+				http_event(&dev_cache[ri]);
+				live_shm_device(ri);
+				
+				// If we don't have a name, query again, through the pipeline if it's running
+				if ((dev_cache[ri].print == 3) && (dev_cache[ri].seen > config.retry_count))
+				{
+					syslog(LOG_INFO,"Unable to find name for %s!", dev_cache[ri].priv_addr);
+					dev_cache[ri].print = 1;
+				}
+				else if ((dev_cache[ri].print == 3) && (dev_cache[ri].seen < config.retry_count) && name_queue(ri))
+				{
+					// Query name
+					strcpy(dev_cache[ri].name, namequery(&(results+i)->bdaddr));
+					
+					// Did we get one?
+					if (strcmp (dev_cache[ri].name, "VOID") != 0)
+					{
+						syslog(LOG_INFO,"Name retry for %s successful!", dev_cache[ri].priv_addr);
+						// Force print
+						dev_cache[ri].print = 1;
+					}
+					else
+						syslog(LOG_INFO,"Name retry %i for %s failed!",dev_cache[ri].seen, dev_cache[ri].priv_addr);
+				}
+				
+				// Amnesia mode, unless name is still on its way
+				if (config.amnesia >= 0 && dev_cache[ri].print < 4)
+				{
+					// Find current epoch time
+					epoch = time(NULL);
+					if ((epoch - dev_cache[ri].epoch) >= (config.amnesia * 60))
+					{
+						// Update epoch time
+						dev_cache[ri].epoch = epoch;
+						// Set device to print
+						dev_cache[ri].print = 1;
+					}
+				}
+				
+				// Unless we need to get printed, move to next result
+				if (dev_cache[ri].print != 1)
+					break;
+			}
+			else if (strcmp (dev_cache[ri].addr, "") == 0) 
+			{
+				// Write new device MAC (visible and internal use)
+				PROBE2(result__new, &(results+i)->bdaddr, ri);
+				metrics_add(M_DEVICES_NEW, 1);
+				bacpy(&dev_cache[ri].bdaddr, &(results+i)->bdaddr);
+				mac_format_r(&dev_cache[ri].bdaddr, dev_cache[ri].priv_addr);
+				encode_addr(&dev_cache[ri]);
+				
+				// Query for name, in pipeline mode the answer comes later
+				pending = 0;
+				if (config.getname && !name_queue(ri))
+				{
+					strcpy(dev_cache[ri].name, "VOID");
+					pending = 1;
+				}
+				else if (config.getname)
+					strcpy(dev_cache[ri].name, namequery(&(results+i)->bdaddr));
+				else
+					strcpy(dev_cache[ri].name, "IGNORED");
+
+				// Get time found
+				strcpy(dev_cache[ri].time, get_localtime());
+				dev_cache[ri].epoch = time(NULL);
+				dev_cache[ri].last_seen = dev_cache[ri].epoch;
+				session_seen(&dev_cache[ri], dev_cache[ri].last_seen);
+				
+				// Class info
+				dev_cache[ri].flags = (results+i)->dev_class[2];
+				dev_cache[ri].major_class = (results+i)->dev_class[1];
+				dev_cache[ri].minor_class = (results+i)->dev_class[0];
+				
+				// Init misc variables
+				dev_cache[ri].seen = 1;
+				
+				// Increment index	
+				cache_index++;	
+				
+				// Logged once the name comes back
+				if (pending)
+					break;
+				
+				// If we have a device name, get printed
+				if (strcmp (dev_cache[ri].name, "VOID") != 0)
+					dev_cache[ri].print = 1;
+				else
+				{
+					// Found with no name.
+					// Print message to syslog, prevent printing, and move on
+					syslog(LOG_INFO,"Device %s discovered with no name, will retry", dev_cache[ri].priv_addr);
+					dev_cache[ri].print = 3;
+					break;
+				}											
+			}
+						
+			// Ready to print?
+			if (dev_cache[ri].print == 1) 
+			{	
+				log_device(ri);
+				break;
+			}
+			// If we make it this far, it means we will check next stored device
+		}
+		// Drop old records once the live log is mostly repeats
+		if (live_idx >= 0 && live_header.count >= 2 * live_compacted + LIVE_COMPACT)
+			live_compact();
+	}
+}
+
+// Inquiry is over, status is 1 if it finished and -1 if it failed
+void cycle_done (int status)
+{
+	int num_results = (status < 0) ? -1 : inquiry_results();
+	
+	PROBE1(inquiry__done, num_results);
+	live_shm_scan(num_results);
+	
+	if (status < 0)
+	{
+		// Increment error count
+		error_count++;
+		metrics_add(M_BLUEZ_ERRORS, 1);
+		
+		// Ignore occasional errors on Pwn Plug and OpenWRT
+		#if !defined PWNPLUG || OPENWRT
+		struct utsname sysinfo;
+		
+		// All other platforms, print error and bail out
+		syslog(LOG_ERR,"Received error from BlueZ!");
+		printf("Scan failed!\n");
+		// Check for kernel 3.0.x
+		uname(&sysinfo);
+		if (!strncmp("3.0.",sysinfo.release,4))
+		{
+			printf("\n");
+			printf("-----------------------------------------------------\n");
+			printf("Device scanning failed, and you are running a 3.0.x\n");
+			printf("Linux kernel. This failure is probably due to the\n");
+			printf("following kernel bug:\n");
+			printf("\n");
+			printf("http://marc.info/?l=linux-kernel&m=131629118406044\n");
+			printf("\n");
+			printf("You will need to upgrade your kernel to at least the\n");
+			printf("the 3.1 series to continue.\n");
+			printf("-----------------------------------------------------\n");
+
+		}
+		scan_fail("Scan failed!");
+		#else
+		// Exit on back to back errors
+		if (error_count > 5)
+		{
+			printf("Scan failed!\n");				
+			syslog(LOG_ERR,"BlueZ not responding, unrecoverable!");
+			scan_fail("BlueZ not responding, unrecoverable!");
+		}
+		
+		// Otherwise, throttle back a bit, timer starts the next one
+		syslog(LOG_ERR,"Received error from BlueZ, retrying.");
+		#endif
+	}
+	else
+	{
+		// Clear error counter
+		error_count = 0;
+	}
+	
+	// Cycle is done, make its numbers visible
+	metrics_add(M_CYCLES, 1);
+	metrics_set(M_ERROR_STREAK, error_count);
+	metrics_set(M_CACHE_ENTRIES, cache_index);
+	metrics_observe(H_CYCLE_RESULTS, (num_results > 0) ? num_results : 0);
+	metrics_observe(H_CYCLE_TIME, metrics_now() - inquiry_started);
+	flush_output();
+	metrics_publish();
+	
+	// Swap config between scans so each one runs with a single config
+	if (reload_pending)
+		reload_config();
+}
+
+// Start next inquiry, timer tries again if it fails
+void scan_next (void)
+{
+	if (instance->failed)
+		return;
+	
+	if (inquiry_start(scan_window))
+		cycle_done(-1);
+}
+
+// Inquiry socket has something for us
+void scan_events (void)
+{
+	int status, num_results;
+	
+	num_results = inquiry_read(results, &status);
+	if (num_results > 0)
+		handle_results(num_results);
+	if (status)
+		cycle_done(status);
+	
+	// Straight into the next one, unless BlueZ needs a moment
+	if (status > 0)
+		scan_next();
+}
+
+// Once a second, whatever else is going on
+void handle_timer (void)
+{
+	loop_clear(loop_timer);
+	
+	// Anything the inquiry socket has goes first, so a late finish
+	// isn't mistaken for a hung inquiry
+	scan_events();
+	if (inquiry_running && metrics_now() - inquiry_started > scan_window * 1.28 + INQUIRY_GRACE)
+	{
+		syslog(LOG_ERR,"Inquiry didn't finish in time!");
+		inquiry_cancel();
+		cycle_done(-1);
+	}
+	else if (!inquiry_running)
+		scan_next();
+	
+	// Close sessions of devices that left
+	sessions_expire(time(NULL));
+	
+	// Nothing sits in the output buffer for long
+	flush_output();
+	metrics_publish();
+	sock_service();
+}
+
+
+// Startup failed partway through a progress line
+static int open_failed (struct bluelog *bl, const char *error)
+{
+	if (!config.quiet)
+		printf("\n");
+	snprintf(bl->error, sizeof(bl->error), "%s", error);
+	return(-1);
+}
+
+struct bluelog* bluelog_new (void)
+{
+	static int created = 0;
+	
+	// Globals can't be put back the way they were, so only ever one
+	if (created || (instance = calloc(1, sizeof(struct bluelog))) == NULL)
+		return(NULL);
+	created = 1;
+	
+	// Nothing open yet, so bluelog_close() leaves it alone
+	config.bt_socket = -1;
+	
+	// Setup libmackerel
+	mac_init();
+	return(instance);
+}
+
+int bluelog_load (struct bluelog *bl)
+{
+	if (!cfg_exists())
+		return(1);
+	
+	if (cfg_load(&config) != 0)
+	{
+		snprintf(bl->error, sizeof(bl->error), "%s", cfg_error);
+		return(-1);
+	}
+	cfg_from_file = 1;
+	return(0);
+}
+
+int bluelog_set (struct bluelog *bl, const char *key, const char *value)
+{
+	char copy[MAX_VALUE_LEN];
+	int bad;
+	
+	if (strlen(value) >= sizeof(copy))
+	{
+		snprintf(bl->error, sizeof(bl->error), "Value for %s is too long!", key);
+		return(1);
+	}
+	strcpy(copy, value);
+	
+	if ((bad = cfg_set(&config, key, copy)) < 0)
+		snprintf(bl->error, sizeof(bl->error), "Unknown option %s!", key);
+	else if (bad)
+		snprintf(bl->error, sizeof(bl->error), "Invalid value for %s!", key);
+	return(bad != 0);
+}
+
+int bluelog_get (struct bluelog *bl, const char *key, int *value)
+{
+	if (cfg_get(&config, key, value))
+	{
+		snprintf(bl->error, sizeof(bl->error), "Unknown option %s!", key);
+		return(1);
+	}
+	return(0);
+}
+
+void bluelog_callback (struct bluelog *bl, int events, bluelog_cb cb, void *data)
+{
+	bl->cb = cb;
+	bl->events = events;
+	bl->data = data;
+}
+
+int bluelog_open (struct bluelog *bl, const char *device, const char *outfilename)
+{
+	// MAC of adapter
+	bdaddr_t bdaddr;
+	
+	// Default log file is named after the date
+	char out_file[1000] = OUT_PATH;
+	
+	// Mode to open output file in
+	char *filemode = "a+";
+	
+	// Make sure everybody plays nice
+	if (cfg_validate(&config))
+	{
+		snprintf(bl->error, sizeof(bl->error), "%s", cfg_error);
+		return(-1);
+	}
+	
+	// Use keyed hash for encoding if there is a key
+	if (config.keyed)
+		mac_key_set(config.encode_key);
+	
+	// Load OUI database once up front rather than on every lookup
+	if (config.getmanufacturer)
+	{
+		if (!config.quiet)
+			printf("Loading OUI database...");
+		if (mac_oui_load(OUIDB) && mac_oui_load(OUIFILE))
+		{
+			if (!config.quiet)
+				printf("FAILED\n");
+			syslog(LOG_ERR,"Unable to load OUI database from %s or %s!", OUIDB, OUIFILE);
+		}
+		else if (!config.quiet)
+			printf("OK (%i entries)\n", oui_count);
+	}
+	
+	// Adapter as given, from config file, or autodetected
+	bacpy(&bdaddr, BDADDR_ANY);
+	if (device != NULL && !strncasecmp(device, "hci", 3))
+		hci_devba(atoi(device + 3), &bdaddr);
+	else if (device != NULL)
+		str2ba(device, &bdaddr);
+	else if (cfg_from_file)
+		hci_devba(config.hci_device, &bdaddr);
+	
+	// Init Hardware
+	ba2str(&bdaddr, config.addr);
+	if (!strcmp(config.addr, "00:00:00:00:00:00"))
+	{
+		if (!config.quiet)
+			printf("Autodetecting device...");
+		bl->device = hci_get_route(NULL);
+		// Put autodetected device MAC into addr
+		hci_devba(bl->device, &bdaddr);
+		ba2str(&bdaddr, config.addr);
+	}
+	else
+	{
+		if (!config.quiet)
+			printf("Initializing device...");
+		bl->device = hci_devid(config.addr);
+	}
+	
+	// Open device and catch errors, inquiry gets a socket of its own
+	config.bt_socket = hci_open_dev(bl->device); 
+	if (bl->device < 0 || config.bt_socket < 0 || inquiry_open(bl->device))
+		return(open_failed(bl, "Error initializing Bluetooth device!"));
+	
+	// If we get here the device should be online.
+	if (!config.quiet)
+		printf("OK\n");
+
+	// Status message for BPP
+	if (!config.quiet)
+		if (config.bluepropro)
+			printf("Output formatted for BlueProPro.\n"
+				   "More Info: www.hackfromacave.com\n");
+				   	
+	// Open socket 
+	if (config.udponly && open_udp_socket())
+		return(open_failed(bl, cfg_error));
+	
+	// Open subscriber socket
+	if (config.unixsock && open_unix_socket())
+		return(open_failed(bl, cfg_error));
+	
+	// Start built-in web server
+	if (config.http_port && open_http_server())
+		return(open_failed(bl, cfg_error));
+
+	// Open output file, unless in networking mode
+	if (outfilename == NULL)
+	{
+		strncat(out_file, file_timestamp(), sizeof(out_file) - strlen(out_file) - 1);
+		outfilename = out_file;
+	}
+	if (!config.syslogonly && !config.udponly)
+	{
+		if (config.bluelive)
+		{
+			// Change location of output file
+			outfilename = LIVE_OUT;
+			filemode = "w";
+			if (!config.quiet)
+				printf("Starting Bluelog Live...\n");
+		}
+		if (!config.quiet)		
+			printf("Opening output file: %s...", outfilename);
+		if ((outfile = fopen(outfilename, filemode)) == NULL)
+			return(open_failed(bl, "Error opening output file!"));
+		if (!config.quiet)
+			printf("OK\n");
+	}
+	else
+		if (!config.quiet)
+			printf("Network mode enabled, not creating log file.\n");
+	
+	// Kept for reload, in case output goes back to the file
+	bl->outfilename = strdup(outfilename);
+	config.outfilename = bl->outfilename;
+	
+	// Open status file and log index
+	if (config.bluelive)
+	{
+		if (live_index_open())
+			return(open_failed(bl, cfg_error));
+		live_shm_open();
+		
+		if (!config.quiet)		
+			printf("Opening info file: %s...", LIVE_INF);
+		if ((infofile = fopen(LIVE_INF,"w")) == NULL)
+			return(open_failed(bl, "Error opening info file!"));
+		if (!config.quiet)
+			printf("OK\n");
+	}
+	
+	// Get and print time to console and file
+	strcpy(bl->started, get_localtime());
+	
+	if (!config.daemon)
+		printf("Scan started at [%s] on %s\n", bl->started, config.addr);
+	
+	if (config.showtime && (outfile != NULL))
+	{
+		fprintf(outfile,"[%s] Scan started on %s\n", bl->started, config.addr);
+		// Make sure this gets written out
+		fflush(outfile);
+	}
+		
+	// Info for Bluelog Live, kept for the web server
+	snprintf(live_info, sizeof(live_info),
+		"<div class=\"sideitem\">%s Version: %s%s</div>\n"
+		"<div class=\"sideitem\">Device: %s</div>\n"
+		"<div class=\"sideitem\">Started: %s</div>\n",
+		APPNAME, VERSION, VER_MOD, config.addr, bl->started);
+	
+	// Write info file for Bluelog Live
+	if (config.bluelive)
+	{
+		fputs(live_info, infofile);
+		
+		// Think we are done with you now
+		fclose(infofile);
+	}
+	
+	// Log success to this point
+	syslog(LOG_INFO,"Init OK!");
+	return(0);
+}
+
+int bluelog_start (struct bluelog *bl)
+{
+	// Now that PID is known
+	live_shm_status(bl->started);
+	metrics_init();
+	
+	// Threads don't survive a fork, so start them now
+	if (config.pipeline && pipeline_start(bl->device))
+	{
+		scan_fail("Unable to set up pipeline!");
+		return(-1);
+	}
+	http_start();
+	
+	// Init result struct
+	if ((results = (inquiry_info*)malloc(INQUIRY_MAX * sizeof(inquiry_info))) == NULL)
+	{
+		scan_fail("Unable to allocate inquiry results!");
+		return(-1);
+	}
+	
+	// Everything from here on happens in response to events
+	if (loop_open())
+	{
+		scan_fail("Unable to set up event loop!");
+		return(-1);
+	}
+	scan_next();
+	return(bl->failed ? -1 : 0);
+}
+
+int bluelog_fd (struct bluelog *bl)
+{
+	return(loop_fd);
+}
+
+int bluelog_poll (struct bluelog *bl, int timeout)
+{
+	// Events from one wakeup of the event loop
+	struct epoll_event events[LOOP_EVENTS];
+	int num_events, i, fd;
+	
+	if (bl->failed)
+		return(-1);
+	
+	if ((num_events = epoll_wait(loop_fd, events, LOOP_EVENTS, timeout)) < 0)
+	{
+		if (errno == EINTR)
+			return(0);
+		syslog(LOG_ERR,"Event loop failed!");
+		scan_fail("Event loop failed!");
+		return(-1);
+	}
+	
+	// Keep web server out of the cache until we're done with it
+	cache_lock();
+	for (i = 0; i < num_events; i++)
+	{
+		fd = events[i].data.fd;
+		if (fd == inquiry_socket)
+			scan_events();
+		else if (fd == loop_timer)
+			handle_timer();
+		else if (fd == pipeline_reply_wake)
+		{
+			// Log devices whose names just came in
+			loop_clear(pipeline_reply_wake);
+			name_replies();
+		}
+		else
+		{
+			// Subscriber socket or one of its clients
+			sock_service();
+		}
+	}
+	cache_unlock();
+	
+	return(bl->failed ? -1 : num_events);
+}
+
+void bluelog_reload (struct bluelog *bl)
+{
+	// Config reload waits until the current inquiry is done
+	reload_pending = 1;
+}
+
+void bluelog_close (struct bluelog *bl)
+{
+	// Close up shop
+	if (!config.quiet)
+	{
+		printf("\n");
+		printf("Closing files and freeing memory...");
+	}
+	
+	// Sessions still open end now
+	cache_lock();
+	sessions_close_all();
+	cache_unlock();
+	sessions_summary();
+	
+	// Let sink thread finish what's queued before the file goes away
+	pipeline_stop();
+	
+	// Only show this if timestamps are enabled
+	if (config.showtime && (outfile != NULL))
+		fprintf(outfile,"[%s] Scan ended.\n", get_localtime());
+	
+	// Don't try to close a file that doesn't exist, kernel gets mad
+	if (outfile != NULL)
+		fclose(outfile);
+	outfile = NULL;
+	
+	// UDP cleanup
+	if (config.udponly && config.udp_socket >= 0)
+	{
+		// Send message if configured
+		if (config.hangup)
+			send_udp_msg("Disconnect\n");
+		
+		// Close socket
+		close(config.udp_socket);
+	}
+	
+	// Remove subscriber socket
+	close_unix_socket();
+	
+	// Live log index and shared memory
+	if (live_idx >= 0)
+		close(live_idx);
+	live_shm_close();
+	
+	// Final numbers
+	metrics_close();
+	
+	// Event loop
+	if (loop_timer >= 0)
+		close(loop_timer);
+	if (loop_fd >= 0)
+		close(loop_fd);
+	
+	// Always close these
+	free(results);
+	inquiry_close();
+	if (config.bt_socket >= 0)
+		close(config.bt_socket);
+	
+	if (!config.quiet)
+		printf("Done!\n");
+	
+	// Log shutdown to syslog
+	syslog(LOG_INFO, "Shutdown OK.");
+	
+	free(bl->outfilename);
+	free(bl);
+	instance = NULL;
+}
+
+const char* bluelog_error (struct bluelog *bl)
+{
+	return(bl->error);
+}
@@ -0,0 +1,112 @@
+/*
+ *  libbluelog.h - Bluelog scanning as a library
+ *
+ *  Everything the bluelog command does (inquiry, device cache, name
+ *  requests, log file, syslog, UDP, subscriber socket, Bluelog Live) is
+ *  in libbluelog, the command is just one program using it. Another one
+ *  can embed a scanner the same way:
+ *
+ *    struct bluelog *bl = bluelog_new();
+ *    bluelog_set(bl, "GETNAME", "YES");
+ *    bluelog_callback(bl, BLUELOG_NEW | BLUELOG_GONE, seen, NULL);
+ *    if (bluelog_open(bl, "hci0", NULL) || bluelog_start(bl))
+ *      ...bluelog_error(bl)...
+ *    while (bluelog_poll(bl, -1) >= 0)
+ *      ;
+ *    bluelog_close(bl);
+ *
+ *  Options are set by their names in bluelog.conf, before bluelog_open().
+ *  bluelog_fd() can go into the caller's own poll() or epoll, call
+ *  bluelog_poll(bl, 0) whenever it's readable. Callbacks run from inside
+ *  bluelog_poll(), the device is only valid until the callback returns.
+ *
+ *  State is kept in globals, so there is one scanner per process, and it
+ *  isn't thread safe: all calls have to come from the same thread. It
+ *  also still prints progress to the terminal unless QUIET is set.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+#ifndef LIBBLUELOG_H
+#define LIBBLUELOG_H
+
+#include <stdint.h>
+
+// Only these are exported from libbluelog.so
+#define BLUELOG_API __attribute__((visibility("default")))
+
+// Device events, can be ORed together. Same as the subscriber socket,
+// SESSION comes right after GONE and isn't in ALL.
+#define BLUELOG_NEW 0x1
+#define BLUELOG_SEEN 0x2
+#define BLUELOG_GONE 0x4
+#define BLUELOG_SESSION 0x8
+#define BLUELOG_ALL (BLUELOG_NEW | BLUELOG_SEEN | BLUELOG_GONE)
+
+struct bluelog;
+
+struct bluelog_device
+{
+	const char *addr; // MAC as logged, encoded or obfuscated if enabled
+	const char *name; // "VOID" if no answer, "IGNORED" if names are off
+	const char *time; // Last seen, local time
+	uint8_t bdaddr[6]; // Real address, least significant byte first
+	uint8_t flags;
+	uint8_t major_class;
+	uint8_t minor_class;
+	unsigned int seen; // Inquiries it showed up in
+	uint64_t last_seen; // Epoch
+	uint64_t session_start; // First sighting this session, epoch
+	unsigned int sightings; // Inquiries it showed up in this session
+	unsigned int sessions; // Closed sessions, this one included once GONE
+	double dwell_mean; // Mean dwell of closed sessions, seconds
+};
+
+typedef void (*bluelog_cb)(struct bluelog *bl, int event, const struct bluelog_device *dev, void *data);
+
+// New scanner with default options, NULL if there already is one
+BLUELOG_API struct bluelog* bluelog_new (void);
+
+// Read options from bluelog.conf. Returns 0 if loaded, 1 if there is no
+// config file, -1 if it's bad. Only a loaded config can be reloaded.
+BLUELOG_API int bluelog_load (struct bluelog *bl);
+
+// Set option by its name in bluelog.conf, non-zero if key or value is bad
+BLUELOG_API int bluelog_set (struct bluelog *bl, const char *key, const char *value);
+
+// Read back yes/no or number option, non-zero if there is no such option
+BLUELOG_API int bluelog_get (struct bluelog *bl, const char *key, int *value);
+
+// Call cb for the given events
+BLUELOG_API void bluelog_callback (struct bluelog *bl, int events, bluelog_cb cb, void *data);
+
+// Check options, open adapter and outputs. Device is "hciN" or a MAC, NULL
+// for HCIDEVICE from the config file or the first adapter. Log file
+// defaults to one named after the date. Non-zero on failure, including
+// bad UDP settings and sockets or files that can't be opened, the process
+// is never ended from here.
+BLUELOG_API int bluelog_open (struct bluelog *bl, const char *device, const char *outfile);
+
+// Start threads and the first inquiry. Call once the process won't fork
+// again. Non-zero if the pipeline or event loop can't be set up.
+BLUELOG_API int bluelog_start (struct bluelog *bl);
+
+// Readable whenever bluelog_poll() has something to do
+BLUELOG_API int bluelog_fd (struct bluelog *bl);
+
+// Handle whatever is ready, waiting up to timeout ms (-1 is forever).
+// Returns -1 once the scan has failed for good, the scanner should be
+// closed then.
+BLUELOG_API int bluelog_poll (struct bluelog *bl, int timeout);
+
+// Re-read bluelog.conf once the current inquiry is done
+BLUELOG_API void bluelog_reload (struct bluelog *bl);
+
+// Stop scanning, close everything and free bl
+BLUELOG_API void bluelog_close (struct bluelog *bl);
+
+// What went wrong in the last call that failed
+BLUELOG_API const char* bluelog_error (struct bluelog *bl);
+
+#endif
@@ -9,36 +9,304 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 // For OUI lookup
-#include <fcntl.h>
-#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+// Binary MAC for the reentrant functions. Same layout as BlueZ, with the
+// last octet of the printed address first. Defined here for programs that
+// don't use BlueZ.
+#ifndef __BLUETOOTH_H
+typedef struct {
+	uint8_t b[6];
+} __attribute__((packed)) bdaddr_t;
+#endif
+
 // OUI file parameters
 // Point to valid file (this is done in config.h for Bluelog)
 //#define OUIFILE "oui.txt"
-// Characters until vendor name starts
-#define TXTOFFSET 9
-
-// CRC parameters (default values are for CRC-32):
-const int order = 32;
-const unsigned long polynom = 0x4c11db7;
-const int direct = 1;
-const unsigned long crcinit = 0xffffffff;
-const unsigned long crcxor = 0xffffffff;
-const int refin = 1;
-const int refout = 1;
-
-// Global values:
-unsigned long crcmask;
-unsigned long crchighbit;
-unsigned long crcinit_direct;
-unsigned long crcinit_nondirect;
-unsigned long crctab[256];
+// Optionally, precompiled database to try first
+//#define OUIDB "oui.db"
+// Longest vendor name kept
+#define MAX_VENDOR 128
+
+// Precompiled OUI database format
+#define OUI_DB_MAGIC "BLOUIDB"
+#define OUI_DB_VERSION 1
+#define OUI_DB_BYTEORDER 0x01020304
+// Sections for MA-L (24-bit), MA-M (28-bit), and MA-S (36-bit) prefixes
+#define OUI_SECTIONS 3
+
+// CRC-32 polynomial (reflected)
+#define CRC32_POLY 0xEDB88320
+// Space for each result from mac_encode_many()
+#define ENCODE_LEN 12
+
+// CRC lookup tables for slicing-by-8
+uint32_t crctab[8][256];
+// Implementation picked for this CPU, works on raw register value
+uint32_t (*crc32_update)(uint32_t crc, const unsigned char* data, size_t len) = NULL;
+// Set if hardware path also beats the tables on short buffers
+int crc32_short_hw = 0;
+
+// Precompiled database header, followed by entries then name pool
+struct oui_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t count[OUI_SECTIONS];
+	uint32_t pool_size;
+	uint32_t checksum; // CRC-32 of entries and name pool
+	uint32_t reserved;
+};
+
+// OUI database entry, sorted by prefix length then prefix
+struct oui_entry
+{
+	uint64_t prefix; // Left aligned in 48-bit MAC
+	uint32_t name; // Offset into oui_names
+	uint32_t bits; // Prefix length
+};
+
+const int oui_bits[OUI_SECTIONS] = {24, 28, 36};
+struct oui_entry *oui_table[OUI_SECTIONS];
+uint32_t oui_counts[OUI_SECTIONS];
+const char *oui_names = NULL; // Pool of unique vendor names
+size_t oui_names_size = 0;
+int oui_count = 0;
+
+// Set when database is mapped from precompiled file
+void *oui_map = NULL;
+size_t oui_map_size = 0;
+
+/*
+ * CRC-32 functions. These were originally based on CRC tester 1.3 by
+ * Sven Reifegerste (http://www.zorc.breitbandkatze.de/crc.html) and worked
+ * bit by bit. They are now table driven (slicing-by-8), with hardware paths
+ * picked at runtime where the CPU has them. The result is the same standard
+ * CRC-32 either way, so encoded MACs match older logs.
+ */
+
+// Fill slicing tables, crctab[0] is the classic byte-at-a-time table
+static void crc32_tables (void)
+{
+	uint32_t crc;
+	int i, j;
+	
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1));
+		crctab[0][i] = crc;
+	}
+	
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crctab[j][i] = (crctab[j - 1][i] >> 8) ^ crctab[0][crctab[j - 1][i] & 0xff];
+}
+
+// Feed 8 bytes through the slicing tables
+static inline uint32_t crc32_step8 (uint32_t crc, const unsigned char* data)
+{
+	uint32_t lo, hi;
+	
+	lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+	hi = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+	
+	return crctab[7][lo & 0xff] ^ crctab[6][(lo >> 8) & 0xff] ^
+		crctab[5][(lo >> 16) & 0xff] ^ crctab[4][lo >> 24] ^
+		crctab[3][hi & 0xff] ^ crctab[2][(hi >> 8) & 0xff] ^
+		crctab[1][(hi >> 16) & 0xff] ^ crctab[0][hi >> 24];
+}
+
+// Portable version, crc is the raw register (not inverted)
+static uint32_t crc32_slice8 (uint32_t crc, const unsigned char* data, size_t len)
+{
+	while (len >= 8)
+	{
+		crc = crc32_step8(crc, data);
+		data += 8;
+		len -= 8;
+	}
+	
+	while (len--)
+		crc = (crc >> 8) ^ crctab[0][(crc ^ *data++) & 0xff];
+	
+	return(crc);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// x86 has a crc32 instruction in SSE4.2, but it computes CRC-32C, which
+// would change every encoded MAC. Carry-less multiply can fold any
+// polynomial, so use that for long buffers. Constants are from Intel's
+// "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ" paper.
+#include <immintrin.h>
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul (uint32_t crc, const unsigned char* data, size_t len)
+{
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+	size_t chunk;
+	
+	// Not worth it for short buffers
+	if (len < 64)
+		return crc32_slice8(crc, data, len);
+	
+	// Fold whole 16 byte blocks, tables handle the rest
+	chunk = len & ~(size_t)15;
+	len -= chunk;
+	
+	x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+	data += 64;
+	chunk -= 64;
+	
+	// Fold four blocks at a time
+	while (chunk >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		
+		y5 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+		
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		
+		data += 64;
+		chunk -= 64;
+	}
+	
+	// Fold down to a single block
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+	
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+	
+	// Remaining single blocks
+	while (chunk >= 16)
+	{
+		x2 = _mm_loadu_si128((const __m128i*)data);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		data += 16;
+		chunk -= 16;
+	}
+	
+	// 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	
+	// Barrett reduction down to 32 bits
+	x0 = _mm_load_si128((const __m128i*)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = _mm_extract_epi32(x1, 1);
+	
+	return crc32_slice8(crc, data, len);
+}
+#elif defined(__aarch64__)
+// ARMv8 has CRC-32 instructions using the same polynomial
+#include <arm_acle.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8 (uint32_t crc, const unsigned char* data, size_t len)
+{
+	uint64_t word;
+	
+	while (len >= 8)
+	{
+		memcpy(&word, data, 8);
+		crc = __crc32d(crc, word);
+		data += 8;
+		len -= 8;
+	}
+	
+	while (len--)
+		crc = __crc32b(crc, *data++);
+	
+	return(crc);
+}
+#endif
+
+// Build tables and pick the fastest implementation for this CPU
+static void crc32_setup (void)
+{
+	crc32_tables();
+	crc32_update = crc32_slice8;
+	
+	#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+		crc32_update = crc32_pclmul;
+	#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+	{
+		crc32_update = crc32_armv8;
+		crc32_short_hw = 1;
+	}
+	#endif
+}
+
+// CRC-32 of buffer, pass 0 to start or previous result to continue
+uint32_t mac_crc32 (uint32_t crc, const void* buffer, size_t len)
+{
+	// In case mac_init() hasn't been called
+	if (crc32_update == NULL)
+		crc32_setup();
+	
+	return ~crc32_update(~crc, buffer, len);
+}
 
 // Get things ready
 int mac_init ()
@@ -47,23 +315,7 @@ int mac_init ()
 	srand(time(NULL));
 	
 	// This sets up CRC encoding
-	int i;
-	unsigned long bit, crc;
-
-	crcmask = ((((unsigned long)1<<(order-1))-1)<<1)|1;
-	crchighbit = (unsigned long)1<<(order-1);
-
-	crcinit_direct = crcinit;
-	crc = crcinit;
-	for (i=0; i<order; i++)
-	{
-		bit = crc & 1;
-		if (bit) crc^= polynom;
-			crc >>= 1;
-
-		if (bit) crc|= crchighbit;	
-	}	
-	crcinit_nondirect = crc;
+	crc32_setup();
 	return(0);
 }
 
@@ -186,115 +438,1069 @@ char* mac_obfuscate (char* full_mac)
 	return(addr_buffer);
 }
 
-// Return vendor from OUI database file
-// Modified from functions in oui.c from BlueZ
-char* mac_get_vendor (char* full_mac)
+// Read hex digits from MAC string into integer, skipping separators
+// Returns number of digits read, stops at first non-hex character
+static int mac_parse_prefix (const char* str, int max_digits, uint64_t* prefix)
 {
-	char oui[9] = {0};
-			
-	// Return OUI (also verify)
-	strncpy(oui, mac_get_oui(full_mac), 9);
+	int digits, c;
 	
-	struct stat st;
-	char *str, *map, *off, *end;
-	int fd;
+	*prefix = 0;
+	for (digits = 0; digits < max_digits; str++)
+	{
+		c = *str;
+		if (c == ':' || c == '-')
+			continue;
+		
+		if (c >= '0' && c <= '9')
+			c -= '0';
+		else if (c >= 'A' && c <= 'F')
+			c -= 'A' - 10;
+		else if (c >= 'a' && c <= 'f')
+			c -= 'a' - 10;
+		else
+			break;
+		
+		*prefix = (*prefix << 4) | c;
+		digits++;
+	}
+	return(digits);
+}
 
-	fd = open(OUIFILE, O_RDONLY);
-	if (fd < 0)
-		return("NO_OUI_FILE");
+// Sort OUI entries by prefix length, then prefix
+static int oui_compare (const void* a, const void* b)
+{
+	const struct oui_entry* ea = a;
+	const struct oui_entry* eb = b;
+	
+	if (ea->bits != eb->bits)
+		return (ea->bits > eb->bits) - (ea->bits < eb->bits);
+	return (ea->prefix > eb->prefix) - (ea->prefix < eb->prefix);
+}
+
+// String hash used to intern vendor names while loading
+static uint32_t oui_hash (const char* str)
+{
+	uint32_t hash = 2166136261u;
+	while (*str)
+		hash = (hash ^ (unsigned char)*str++) * 16777619u;
+	return(hash);
+}
+
+// Double intern table, rehashing names already in pool
+static uint32_t* oui_intern_grow (uint32_t* intern, size_t* intern_size, const char* pool)
+{
+	uint32_t *grown, slot;
+	size_t i, size = *intern_size * 2;
+	
+	if ((grown = calloc(size, sizeof(uint32_t))) == NULL)
+		return(NULL);
+	
+	for (i = 0; i < *intern_size; i++)
+	{
+		if (!intern[i])
+			continue;
+		slot = oui_hash(pool + intern[i]) & (size - 1);
+		while (grown[slot])
+			slot = (slot + 1) & (size - 1);
+		grown[slot] = intern[i];
+	}
+	
+	free(intern);
+	*intern_size = size;
+	return(grown);
+}
 
-	if (fstat(fd, &st) < 0)
+// Point section tables at sorted entries
+static void oui_sections (struct oui_entry* entries)
+{
+	int i;
+	
+	oui_count = 0;
+	for (i = 0; i < OUI_SECTIONS; i++)
 	{
-		close(fd);
-		return("CANT_STAT_FILE");
+		oui_table[i] = entries + oui_count;
+		oui_count += oui_counts[i];
 	}
+}
 
-	str = malloc(128);
-	if (!str)
+// Map precompiled database file, no parsing needed
+static int mac_oui_map (int fd, size_t size)
+{
+	const struct oui_header* header;
+	const struct oui_entry* entries;
+	const char* map;
+	const char* pool;
+	size_t entries_len;
+	int i, n;
+	
+	// Too short to even hold the header
+	if (size < sizeof(struct oui_header))
+		return(1);
+	
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return(1);
+	header = (const struct oui_header*)map;
+	
+	// Written on a machine with the same byte order?
+	if (header->version != OUI_DB_VERSION || header->byteorder != OUI_DB_BYTEORDER)
+		goto fail;
+	
+	entries_len = 0;
+	for (i = 0; i < OUI_SECTIONS; i++)
 	{
-		close(fd);
-		return("MALLOC_FAILED");
+		if (header->count[i] > size / sizeof(struct oui_entry))
+			goto fail;
+		oui_counts[i] = header->count[i];
+		entries_len += oui_counts[i] * sizeof(struct oui_entry);
 	}
+	
+	// Make sure the file is as big as it claims and intact
+	if (header->pool_size > size || sizeof(struct oui_header) + entries_len + header->pool_size != size)
+		goto fail;
+	if (mac_crc32(0, map + sizeof(struct oui_header), size - sizeof(struct oui_header)) != header->checksum)
+		goto fail;
+	
+	// A matching CRC doesn't mean it was built right, every name has to
+	// start inside the pool and the pool has to end in a NUL
+	entries = (const struct oui_entry*)(map + sizeof(struct oui_header));
+	pool = map + sizeof(struct oui_header) + entries_len;
+	if (header->pool_size == 0 || pool[header->pool_size - 1] != '\0')
+		goto fail;
+	n = entries_len / sizeof(struct oui_entry);
+	for (i = 0; i < n; i++)
+		if (entries[i].name >= header->pool_size)
+			goto fail;
+	
+	oui_sections((struct oui_entry*)entries);
+	oui_names = pool;
+	oui_names_size = header->pool_size;
+	oui_map = (void*)map;
+	oui_map_size = size;
+	return(0);
 
-	memset(str, 0, 128);
+fail:
+	munmap((void*)map, size);
+	return(1);
+}
 
-	map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (!map || map == MAP_FAILED)
+// Parse OUI text file, one "XX:XX:XX,Vendor" entry per line. Longer
+// prefixes (MA-M and MA-S blocks) have 7 or 9 hex digits before the comma.
+static int mac_oui_parse (FILE* ouifile)
+{
+	char line[MAX_VENDOR + 32];
+	char *name, *pool = NULL, *grown_pool;
+	uint32_t slot, offset, *intern = NULL, *grown;
+	uint64_t prefix;
+	size_t pool_len = 0, pool_size, table_size = 0, intern_size, unique = 0, count = 0, i, j;
+	struct oui_entry *entries = NULL, *grown_entries;
+	int digits;
+	
+	// Hash table of offsets into name pool, 0 means empty slot
+	intern_size = 16384;
+	intern = calloc(intern_size, sizeof(uint32_t));
+	
+	// Reserve first byte of pool so no name lives at offset 0
+	pool_size = 65536;
+	pool = malloc(pool_size);
+	if (intern == NULL || pool == NULL)
+		goto fail;
+	pool[pool_len++] = '\0';
+	
+	while (fgets(line, sizeof(line), ouifile) != NULL)
 	{
-		free(str);
-		close(fd);
-		return("MMAP_FAILED");
+		// Skip anything that isn't "PREFIX,Vendor"
+		if ((name = strchr(line, ',')) == NULL)
+			continue;
+		*name++ = '\0';
+		name[strcspn(name, "\r\n")] = '\0';
+		
+		digits = mac_parse_prefix(line, 12, &prefix);
+		if (digits != 6 && digits != 7 && digits != 9)
+			continue;
+		
+		// Find name in pool, or add it
+		slot = oui_hash(name) & (intern_size - 1);
+		while (intern[slot] && strcmp(pool + intern[slot], name))
+			slot = (slot + 1) & (intern_size - 1);
+		
+		offset = intern[slot];
+		if (!offset)
+		{
+			while (pool_len + strlen(name) + 1 > pool_size)
+			{
+				if ((grown_pool = realloc(pool, pool_size * 2)) == NULL)
+					goto fail;
+				pool = grown_pool;
+				pool_size *= 2;
+			}
+			offset = intern[slot] = pool_len;
+			strcpy(pool + pool_len, name);
+			pool_len += strlen(name) + 1;
+			
+			// Keep intern table under half full
+			if (++unique > intern_size / 2)
+			{
+				if ((grown = oui_intern_grow(intern, &intern_size, pool)) == NULL)
+					goto fail;
+				intern = grown;
+			}
+		}
+		
+		// Grow table as needed
+		if (count == table_size)
+		{
+			table_size = table_size ? table_size * 2 : 4096;
+			if ((grown_entries = realloc(entries, table_size * sizeof(struct oui_entry))) == NULL)
+				goto fail;
+			entries = grown_entries;
+		}
+		
+		// Store prefix left aligned in a 48-bit MAC
+		entries[count].bits = digits * 4;
+		entries[count].prefix = prefix << (48 - digits * 4);
+		entries[count].name = offset;
+		count++;
 	}
+	
+	qsort(entries, count, sizeof(struct oui_entry), oui_compare);
+	
+	// Drop duplicate prefixes
+	for (i = 1, j = 0; i < count; i++)
+		if (entries[i].prefix != entries[j].prefix || entries[i].bits != entries[j].bits)
+			entries[++j] = entries[i];
+	if (count)
+		count = j + 1;
+	
+	// Count entries in each section
+	memset(oui_counts, 0, sizeof(oui_counts));
+	for (i = 0; i < count; i++)
+		for (j = 0; j < OUI_SECTIONS; j++)
+			if (entries[i].bits == oui_bits[j])
+				oui_counts[j]++;
+	
+	oui_sections(entries);
+	oui_names = pool;
+	oui_names_size = pool_len;
+	free(intern);
+	return(0);
+	
+fail:
+	free(intern);
+	free(entries);
+	free(pool);
+	return(1);
+}
 
-	off = strstr(map, oui);
-	if (off)
+// Load OUI database into memory, either a precompiled database created
+// with mac_oui_write() or the text file. Only needs to happen once.
+int mac_oui_load (const char* filename)
+{
+	FILE* ouifile;
+	struct stat st;
+	char magic[sizeof(OUI_DB_MAGIC)];
+	int result;
+	
+	if (oui_names != NULL)
+		return(0);
+	
+	if ((ouifile = fopen(filename, "r")) == NULL)
+		return(1);
+	
+	// Precompiled database gets mapped as-is
+	if (fread(magic, 1, sizeof(magic), ouifile) == sizeof(magic) && !memcmp(magic, OUI_DB_MAGIC, sizeof(magic)))
 	{
-		off += TXTOFFSET;
-		end = strpbrk(off, "\r\n");
-		strncpy(str, off, end - off);
+		if (fstat(fileno(ouifile), &st) < 0)
+			result = 1;
+		else
+			result = mac_oui_map(fileno(ouifile), st.st_size);
 	}
 	else
 	{
-		free(str);
-		str = "No Record";
+		rewind(ouifile);
+		result = mac_oui_parse(ouifile);
 	}
+	
+	fclose(ouifile);
+	return(result);
+}
 
-	munmap(map, st.st_size);
-	close(fd);
-	return str;
+// Write loaded OUI database out in precompiled form
+int mac_oui_write (const char* filename)
+{
+	FILE* dbfile;
+	struct oui_header header;
+	int i;
+	
+	if (oui_names == NULL)
+		return(1);
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OUI_DB_MAGIC, sizeof(header.magic));
+	header.version = OUI_DB_VERSION;
+	header.byteorder = OUI_DB_BYTEORDER;
+	for (i = 0; i < OUI_SECTIONS; i++)
+		header.count[i] = oui_counts[i];
+	header.pool_size = oui_names_size;
+	
+	// Entries and names follow header, checksum covers both
+	header.checksum = mac_crc32(0, oui_table[0], oui_count * sizeof(struct oui_entry));
+	header.checksum = mac_crc32(header.checksum, oui_names, header.pool_size);
+	
+	if ((dbfile = fopen(filename, "w")) == NULL)
+		return(1);
+	
+	if (fwrite(&header, sizeof(header), 1, dbfile) != 1 ||
+		fwrite(oui_table[0], sizeof(struct oui_entry), oui_count, dbfile) != oui_count ||
+		fwrite(oui_names, 1, header.pool_size, dbfile) != header.pool_size)
+	{
+		fclose(dbfile);
+		return(1);
+	}
+	
+	return(fclose(dbfile) != 0);
 }
 
-/*
- * CRC functions based on CRC tester 1.3 written by Sven Reifegerste
- * Available at: http://www.zorc.breitbandkatze.de/crc.html
-*/
+// Return vendor from OUI database
+// Returned string lives in the database, caller must not modify it
+// Find vendor for 48-bit MAC in loaded database
+static const char* mac_vendor_lookup (uint64_t mac)
+{
+	uint64_t key, mask;
+	int section, low, high, mid;
+	
+	// Longest prefix wins, so check MA-S, then MA-M, then MA-L
+	for (section = OUI_SECTIONS - 1; section >= 0; section--)
+	{
+		mask = ~((1ULL << (48 - oui_bits[section])) - 1) & 0xFFFFFFFFFFFFULL;
+		key = mac & mask;
+		
+		low = 0;
+		high = oui_counts[section] - 1;
+		while (low <= high)
+		{
+			mid = (low + high) / 2;
+			if (oui_table[section][mid].prefix < key)
+				low = mid + 1;
+			else if (oui_table[section][mid].prefix > key)
+				high = mid - 1;
+			else
+				return(oui_names + oui_table[section][mid].name);
+		}
+	}
+	
+	return("No Record");
+}
 
-// Used internally for CRC
-unsigned long reflect (unsigned long crc, int bitnum)
+char* mac_get_vendor (char* full_mac)
 {
-	unsigned long i, j=1, crcout=0;
-	for (i=(unsigned long)1<<(bitnum-1); i; i>>=1) {
-		if (crc & i) crcout|=j;
-		j<<= 1;
+	static int tried = 0;
+	uint64_t mac;
+	
+	// Verify first
+	if (mac_verify(full_mac))
+		return("INVALID_MAC");
+	
+	// Load database on first use
+	if (oui_names == NULL && !tried)
+	{
+		tried = 1;
+		#ifdef OUIDB
+		if (mac_oui_load(OUIDB))
+		#endif
+		mac_oui_load(OUIFILE);
 	}
-	return (crcout);
+	if (oui_names == NULL)
+		return("NO_OUI_FILE");
+	
+	mac_parse_prefix(full_mac, 12, &mac);
+	return((char*)mac_vendor_lookup(mac));
+}
+
+// Write CRC as 8 uppercase hex digits
+static void crc32_hex (uint32_t crc, char* out)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	int i;
+	
+	for (i = 7; i >= 0; i--)
+	{
+		out[i] = hex[crc & 0xf];
+		crc >>= 4;
+	}
+	out[8] = '\0';
 }
 
 // Encode MAC with CRC32
 char* mac_encode (char* full_mac)
 {
-	unsigned long i, j, c, bit;
-	unsigned long crc = crcinit_direct;
+	// For return formatting
+	static char addr[9] = {0};
+
+	// Verify first
+	if (mac_verify(full_mac))
+		return("INVALID_MAC");
 	
-	// Static length, could be trouble
-	int len = 17;
+	crc32_hex(mac_crc32(0, full_mac, 17), addr);
+	return(addr);
+}
+
+// Encode array of MACs, out needs ENCODE_LEN characters for each one.
+// Addresses are done four at a time so the table lookups overlap.
+// Returns number of addresses that failed verification.
+int mac_encode_many (char* const* macs, char* out, int count)
+{
+	const unsigned char *m0, *m1, *m2, *m3;
+	uint32_t c0, c1, c2, c3;
+	int i, j, invalid = 0;
 	
-	// For return formatting
-	static char addr[18] = {0};
+	if (crc32_update == NULL)
+		crc32_setup();
+	
+	for (i = 0; i < count; i += 4)
+	{
+		// Take the simple path for stragglers, bad MACs, or CPUs that
+		// are faster on short buffers with their own instructions
+		if (i + 4 > count || crc32_short_hw || mac_verify(macs[i]) ||
+			mac_verify(macs[i + 1]) || mac_verify(macs[i + 2]) || mac_verify(macs[i + 3]))
+		{
+			for (j = i; j < count && j < i + 4; j++)
+			{
+				if (mac_verify(macs[j]))
+				{
+					strcpy(out + j * ENCODE_LEN, "INVALID_MAC");
+					invalid++;
+				}
+				else
+					crc32_hex(~crc32_update(0xFFFFFFFF, (const unsigned char*)macs[j], 17), out + j * ENCODE_LEN);
+			}
+			continue;
+		}
+		
+		m0 = (const unsigned char*)macs[i];
+		m1 = (const unsigned char*)macs[i + 1];
+		m2 = (const unsigned char*)macs[i + 2];
+		m3 = (const unsigned char*)macs[i + 3];
+		
+		// 17 characters is two slices plus one byte
+		c0 = crc32_step8(0xFFFFFFFF, m0);
+		c1 = crc32_step8(0xFFFFFFFF, m1);
+		c2 = crc32_step8(0xFFFFFFFF, m2);
+		c3 = crc32_step8(0xFFFFFFFF, m3);
+		
+		c0 = crc32_step8(c0, m0 + 8);
+		c1 = crc32_step8(c1, m1 + 8);
+		c2 = crc32_step8(c2, m2 + 8);
+		c3 = crc32_step8(c3, m3 + 8);
+		
+		c0 = (c0 >> 8) ^ crctab[0][(c0 ^ m0[16]) & 0xff];
+		c1 = (c1 >> 8) ^ crctab[0][(c1 ^ m1[16]) & 0xff];
+		c2 = (c2 >> 8) ^ crctab[0][(c2 ^ m2[16]) & 0xff];
+		c3 = (c3 >> 8) ^ crctab[0][(c3 ^ m3[16]) & 0xff];
+		
+		crc32_hex(~c0, out + i * ENCODE_LEN);
+		crc32_hex(~c1, out + (i + 1) * ENCODE_LEN);
+		crc32_hex(~c2, out + (i + 2) * ENCODE_LEN);
+		crc32_hex(~c3, out + (i + 3) * ENCODE_LEN);
+	}
+	
+	return(invalid);
+}
+
+/*
+ * Keyed MAC encoding. A plain CRC of a MAC can be reversed by trying every
+ * device in an OUI, so this uses SipHash-2-4 with a secret key instead.
+ * The key used for each address is derived from the master key and an
+ * epoch number, so the same device gets a new pseudonym each epoch.
+ */
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+// Space for each result from mac_keyed_many()
+#define KEYED_LEN 17
+
+// Master key, and key derived for current epoch
+uint64_t mac_key[2];
+int mac_key_valid = 0;
+unsigned int mac_key_gen = 0; // Bumped each time master key changes
+uint64_t mac_epoch_key[2];
+uint64_t mac_key_epoch = 0;
+int mac_epoch_valid = 0;
+
+// SipHash-2-4 of buffer
+uint64_t mac_siphash (const uint64_t key[2], const unsigned char* data, size_t len)
+{
+	uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+	uint64_t m, b = (uint64_t)len << 56;
+	int i;
+	
+	for (; len >= 8; len -= 8, data += 8)
+	{
+		for (m = 0, i = 7; i >= 0; i--)
+			m = (m << 8) | data[i];
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+	
+	// Last partial block with length in top byte
+	for (i = len - 1; i >= 0; i--)
+		b |= (uint64_t)data[i] << (8 * i);
+	
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	
+	return(v0 ^ v1 ^ v2 ^ v3);
+}
+
+// SipHash-2-4 of message shorter than 8 bytes, already packed into the
+// final block (little endian, length in top byte)
+static inline uint64_t mac_siphash_short (const uint64_t key[2], uint64_t b)
+{
+	uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+	
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	
+	return(v0 ^ v1 ^ v2 ^ v3);
+}
+
+// Set master key from 32 hex digits, returns non-zero if invalid
+int mac_key_set (const char* hex_key)
+{
+	uint64_t half[2];
+	int i, c;
+	
+	half[0] = half[1] = 0;
+	for (i = 0; i < 32; i++)
+	{
+		c = hex_key[i];
+		if (c >= '0' && c <= '9')
+			c -= '0';
+		else if (c >= 'A' && c <= 'F')
+			c -= 'A' - 10;
+		else if (c >= 'a' && c <= 'f')
+			c -= 'a' - 10;
+		else
+			return(1);
+		
+		// Key bytes are little endian in each half, as in the SipHash paper
+		half[i / 16] |= (uint64_t)c << (((i % 16) / 2) * 8 + ((i % 2) ? 0 : 4));
+	}
+	if (hex_key[32] != '\0')
+		return(1);
+	
+	mac_key[0] = half[0];
+	mac_key[1] = half[1];
+	mac_key_valid = 1;
+	mac_key_gen++;
+	mac_epoch_valid = 0;
+	return(0);
+}
+
+// Derive key for epoch from master key
+static void mac_key_derive (uint64_t epoch, uint64_t key[2])
+{
+	unsigned char block[9];
+	int i;
+	
+	for (i = 0; i < 8; i++)
+		block[i] = epoch >> (8 * i);
+	
+	block[8] = 0;
+	key[0] = mac_siphash(mac_key, block, sizeof(block));
+	block[8] = 1;
+	key[1] = mac_siphash(mac_key, block, sizeof(block));
+}
 
+// Keep shared epoch key current
+static void mac_key_rotate (uint64_t epoch)
+{
+	if (mac_epoch_valid && epoch == mac_key_epoch)
+		return;
+	
+	mac_key_derive(epoch, mac_epoch_key);
+	mac_key_epoch = epoch;
+	mac_epoch_valid = 1;
+}
+
+// Hash 48-bit MAC into 16 hex digits
+static void mac_keyed_int (uint64_t mac, const uint64_t key[2], char* out)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	uint64_t block, hash;
+	int i;
+	
+	// Six address bytes in transmission order, then the length
+	for (block = 6ULL << 56, i = 0; i < 6; i++)
+		block |= ((mac >> (40 - 8 * i)) & 0xff) << (8 * i);
+	
+	hash = mac_siphash_short(key, block);
+	for (i = 15; i >= 0; i--)
+	{
+		out[i] = hex[hash & 0xf];
+		hash >>= 4;
+	}
+	out[16] = '\0';
+}
+
+// Hash binary form of MAC, so separators and case don't matter
+static void mac_keyed_hex (const char* full_mac, char* out)
+{
+	uint64_t mac;
+	
+	mac_parse_prefix(full_mac, 12, &mac);
+	mac_keyed_int(mac, mac_epoch_key, out);
+}
+
+// Encode MAC with keyed hash for given epoch
+char* mac_keyed (char* full_mac, uint64_t epoch)
+{
+	static char addr[KEYED_LEN] = {0};
+	
 	// Verify first
 	if (mac_verify(full_mac))
 		return("INVALID_MAC");
+	if (!mac_key_valid)
+		return("NO_KEY");
 	
-	for (i=0; i < len; i++)
+	mac_key_rotate(epoch);
+	mac_keyed_hex(full_mac, addr);
+	return(addr);
+}
+
+// Encode array of MACs with keyed hash, out needs KEYED_LEN characters
+// for each one. Returns number of addresses that failed verification.
+int mac_keyed_many (char* const* macs, char* out, int count, uint64_t epoch)
+{
+	int i, invalid = 0;
+	
+	if (!mac_key_valid)
+		return(count);
+	
+	// Key only has to be derived once for the whole batch
+	mac_key_rotate(epoch);
+	
+	for (i = 0; i < count; i++)
 	{
-		c = (unsigned long)*full_mac++;
-		if (refin) c = reflect(c, 8);
+		if (mac_verify(macs[i]))
+		{
+			strcpy(out + i * KEYED_LEN, "INVALID_MAC");
+			invalid++;
+		}
+		else
+			mac_keyed_hex(macs[i], out + i * KEYED_LEN);
+	}
+	
+	return(invalid);
+}
 
-		for (j=0x80; j; j>>=1) {
+/*
+ * Reentrant versions of the above. These take a binary address and write
+ * into a buffer supplied by the caller, so they can be used from multiple
+ * threads at once. Call mac_init() (and mac_oui_load() or mac_key_set() if
+ * needed) before starting any threads.
+ */
+
+// Buffer sizes for reentrant functions, including terminator
+#define MAC_STR_LEN 18
+#define MAC_OUI_LEN 9
+#define MAC_ENCODE_LEN 9
+#define MAC_KEYED_LEN 17
 
-			bit = crc & crchighbit;
-			crc<<= 1;
-			if (c & j) bit^= crchighbit;
-			if (bit) crc^= polynom;
+// Binary MAC as 48-bit integer, first printed octet on top
+static inline uint64_t mac_to_int (const bdaddr_t* addr)
+{
+	return ((uint64_t)addr->b[5] << 40) | ((uint64_t)addr->b[4] << 32) |
+		((uint64_t)addr->b[3] << 24) | ((uint64_t)addr->b[2] << 16) |
+		((uint64_t)addr->b[1] << 8) | addr->b[0];
+}
+
+// Write octets of binary MAC with given separator
+static void mac_write (const bdaddr_t* addr, int octets, char separator, char* buffer)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	int i;
+	
+	for (i = 0; i < octets; i++)
+	{
+		*buffer++ = hex[addr->b[5 - i] >> 4];
+		*buffer++ = hex[addr->b[5 - i] & 0xf];
+		if (i < octets - 1)
+			*buffer++ = separator;
+	}
+	*buffer = '\0';
+}
+
+// Format binary MAC as string, buffer needs MAC_STR_LEN
+char* mac_format_r (const bdaddr_t* addr, char* buffer)
+{
+	mac_write(addr, 6, ':', buffer);
+	return(buffer);
+}
+
+/*
+ * Batch conversion between binary and printed MACs. Strings are stored
+ * back to back, MAC_STR_LEN bytes apart. Uses SSE2 or NEON to do a pair
+ * of addresses at a time where available, plain C otherwise.
+ */
+
+// Binary MAC with first printed octet in lowest byte
+static inline uint64_t mac_print_order (const bdaddr_t* addr)
+{
+	return(__builtin_bswap64(mac_to_int(addr) << 16));
+}
+
+// Value of hex digit, or -1
+static inline int mac_nibble (unsigned char c)
+{
+	if ((unsigned char)(c - '0') < 10)
+		return(c - '0');
+	c |= 0x20;
+	if ((unsigned char)(c - 'a') < 6)
+		return(c - 'a' + 10);
+	return(-1);
+}
+
+// Parse single printed MAC, takes colons or dashes like mac_verify()
+static int mac_parse_scalar (const char* in, bdaddr_t* addr)
+{
+	int i, high, low;
+	
+	for (i = 0; i < 6; i++)
+	{
+		high = mac_nibble(in[3 * i]);
+		low = mac_nibble(in[3 * i + 1]);
+		if (high < 0 || low < 0)
+			return(1);
+		if (i < 5 && in[3 * i + 2] != ':' && in[3 * i + 2] != '-')
+			return(1);
+		addr->b[5 - i] = (high << 4) | low;
+	}
+	
+	return(in[17] != '\0');
+}
+
+// Lay out 12 hex digits with separators
+static inline void mac_place (const unsigned char* hex, char* out)
+{
+	int i;
+	
+	for (i = 0; i < 6; i++)
+	{
+		out[3 * i] = hex[2 * i];
+		out[3 * i + 1] = hex[2 * i + 1];
+		out[3 * i + 2] = ':';
+	}
+	out[17] = '\0';
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+// Nibbles to ASCII, '0'-'9' then 'A'-'F'
+static inline __m128i mac_hex_sse2 (__m128i nib)
+{
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(nib, _mm_set1_epi8(9)), _mm_set1_epi8(7));
+	return(_mm_add_epi8(_mm_add_epi8(nib, _mm_set1_epi8('0')), alpha));
+}
+
+// Write both halves of a hex vector out as MACs
+static inline void mac_store_sse2 (__m128i hex, char* out)
+{
+	#if defined(__SSSE3__)
+	// One shuffle spreads the digits out, then fill in the colons
+	const __m128i spread = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10);
+	const __m128i colons = _mm_setr_epi8(0, 0, ':', 0, 0, ':', 0, 0, ':', 0, 0, ':', 0, 0, ':', 0);
+	
+	_mm_storeu_si128((__m128i*)out, _mm_or_si128(_mm_shuffle_epi8(hex, spread), colons));
+	out[16] = _mm_extract_epi16(hex, 5) >> 8;
+	out[17] = '\0';
+	#else
+	unsigned char text[16];
+	
+	_mm_storeu_si128((__m128i*)text, hex);
+	mac_place(text, out);
+	#endif
+}
+
+static void mac_format_pair (const bdaddr_t* a, const bdaddr_t* b, char* out)
+{
+	__m128i bytes, high, low, mask = _mm_set1_epi8(0x0f);
+	
+	bytes = _mm_set_epi64x(mac_print_order(b), mac_print_order(a));
+	high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+	low = _mm_and_si128(bytes, mask);
+	
+	mac_store_sse2(mac_hex_sse2(_mm_unpacklo_epi8(high, low)), out);
+	mac_store_sse2(mac_hex_sse2(_mm_unpackhi_epi8(high, low)), out + MAC_STR_LEN);
+}
+
+// Parse one MAC, needs 16 readable bytes at in
+static int mac_parse_simd (const char* in, bdaddr_t* addr)
+{
+	const __m128i seps = _mm_setr_epi8(0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0);
+	__m128i text, digit, alpha, is_digit, is_alpha, is_sep, nib, valid;
+	unsigned char octets[16];
+	int last;
+	
+	text = _mm_loadu_si128((const __m128i*)in);
+	digit = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+	alpha = _mm_sub_epi8(_mm_or_si128(text, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	
+	// Unsigned range checks, x <= max when min(x, max) == x
+	is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+	is_sep = _mm_or_si128(_mm_cmpeq_epi8(text, _mm_set1_epi8(':')), _mm_cmpeq_epi8(text, _mm_set1_epi8('-')));
+	
+	// Hex everywhere except every third character
+	valid = _mm_or_si128(_mm_andnot_si128(seps, _mm_or_si128(is_digit, is_alpha)), _mm_and_si128(seps, is_sep));
+	last = mac_nibble(in[16]);
+	if (_mm_movemask_epi8(valid) != 0xffff || last < 0 || in[17] != '\0')
+		return(1);
+	
+	// Join each digit with the one after it
+	nib = _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+	_mm_storeu_si128((__m128i*)octets, _mm_or_si128(_mm_slli_epi16(nib, 4), _mm_srli_si128(nib, 1)));
+	
+	addr->b[5] = octets[0];
+	addr->b[4] = octets[3];
+	addr->b[3] = octets[6];
+	addr->b[2] = octets[9];
+	addr->b[1] = octets[12];
+	addr->b[0] = octets[15] | last;
+	return(0);
+}
+#define MAC_SIMD 1
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+// Nibbles to ASCII, '0'-'9' then 'A'-'F'
+static inline uint8x16_t mac_hex_neon (uint8x16_t nib)
+{
+	uint8x16_t alpha = vandq_u8(vcgtq_u8(nib, vdupq_n_u8(9)), vdupq_n_u8(7));
+	return(vaddq_u8(vaddq_u8(nib, vdupq_n_u8('0')), alpha));
+}
+
+// Spread digits out and fill in the colons
+static inline void mac_store_neon (uint8x16_t hex, char* out)
+{
+	static const uint8_t spread[16] = { 0, 1, 0xff, 2, 3, 0xff, 4, 5, 0xff, 6, 7, 0xff, 8, 9, 0xff, 10 };
+	static const uint8_t colons[16] = { 0, 0, ':', 0, 0, ':', 0, 0, ':', 0, 0, ':', 0, 0, ':', 0 };
+	
+	vst1q_u8((uint8_t*)out, vorrq_u8(vqtbl1q_u8(hex, vld1q_u8(spread)), vld1q_u8(colons)));
+	out[16] = vgetq_lane_u8(hex, 11);
+	out[17] = '\0';
+}
+
+static void mac_format_pair (const bdaddr_t* a, const bdaddr_t* b, char* out)
+{
+	uint8x16_t bytes, high, low;
+	
+	bytes = vcombine_u8(vcreate_u8(mac_print_order(a)), vcreate_u8(mac_print_order(b)));
+	high = vshrq_n_u8(bytes, 4);
+	low = vandq_u8(bytes, vdupq_n_u8(0x0f));
+	
+	mac_store_neon(mac_hex_neon(vzip1q_u8(high, low)), out);
+	mac_store_neon(mac_hex_neon(vzip2q_u8(high, low)), out + MAC_STR_LEN);
+}
+
+// Parse one MAC, needs 16 readable bytes at in
+static int mac_parse_simd (const char* in, bdaddr_t* addr)
+{
+	static const uint8_t sep_lanes[16] = { 0, 0, 0xff, 0, 0, 0xff, 0, 0, 0xff, 0, 0, 0xff, 0, 0, 0xff, 0 };
+	uint8x16_t text, digit, alpha, is_digit, is_alpha, is_sep, nib, valid;
+	uint8_t octets[16];
+	int last;
+	
+	text = vld1q_u8((const uint8_t*)in);
+	digit = vsubq_u8(text, vdupq_n_u8('0'));
+	alpha = vsubq_u8(vorrq_u8(text, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+	
+	is_digit = vcleq_u8(digit, vdupq_n_u8(9));
+	is_alpha = vcleq_u8(alpha, vdupq_n_u8(5));
+	is_sep = vorrq_u8(vceqq_u8(text, vdupq_n_u8(':')), vceqq_u8(text, vdupq_n_u8('-')));
+	
+	// Hex everywhere except every third character
+	valid = vbslq_u8(vld1q_u8(sep_lanes), is_sep, vorrq_u8(is_digit, is_alpha));
+	last = mac_nibble(in[16]);
+	if (vminvq_u8(valid) != 0xff || last < 0 || in[17] != '\0')
+		return(1);
+	
+	// Join each digit with the one after it
+	nib = vorrq_u8(vandq_u8(is_digit, digit), vandq_u8(is_alpha, vaddq_u8(alpha, vdupq_n_u8(10))));
+	vst1q_u8(octets, vorrq_u8(vshlq_n_u8(nib, 4), vextq_u8(nib, vdupq_n_u8(0), 1)));
+	
+	addr->b[5] = octets[0];
+	addr->b[4] = octets[3];
+	addr->b[3] = octets[6];
+	addr->b[2] = octets[9];
+	addr->b[1] = octets[12];
+	addr->b[0] = octets[15] | last;
+	return(0);
+}
+#define MAC_SIMD 1
+#endif
+
+// Format count MACs into out, which needs count * MAC_STR_LEN
+void mac_format_many (const bdaddr_t* addrs, char* out, int count)
+{
+	int i = 0;
+	
+	#ifdef MAC_SIMD
+	for (; i + 2 <= count; i += 2)
+		mac_format_pair(&addrs[i], &addrs[i + 1], out + i * MAC_STR_LEN);
+	#endif
+	
+	for (; i < count; i++)
+		mac_write(&addrs[i], 6, ':', out + i * MAC_STR_LEN);
+}
+
+// Parse count MACs from in, spaced MAC_STR_LEN apart. Bad entries are
+// zeroed, returns how many there were.
+int mac_parse_many (const char* in, bdaddr_t* addrs, int count)
+{
+	int i, invalid = 0;
+	
+	for (i = 0; i < count; i++)
+	{
+		#ifdef MAC_SIMD
+		if (mac_parse_simd(in + i * MAC_STR_LEN, &addrs[i]))
+		#else
+		if (mac_parse_scalar(in + i * MAC_STR_LEN, &addrs[i]))
+		#endif
+		{
+			memset(&addrs[i], 0, sizeof(bdaddr_t));
+			invalid++;
 		}
-	}	
+	}
+	
+	return(invalid);
+}
 
-	if (refout) crc=reflect(crc, order);
-	crc^= crcxor;
-	crc&= crcmask;
+// Parse printed MAC into binary, returns non-zero if invalid
+int mac_parse_r (const char* full_mac, bdaddr_t* addr)
+{
+	if (full_mac == NULL)
+		return(1);
+	
+	// Short strings could end before the vector load does
+	#ifdef MAC_SIMD
+	if (strnlen(full_mac, MAC_STR_LEN) == 17)
+		return(mac_parse_simd(full_mac, addr));
+	#endif
+	return(mac_parse_scalar(full_mac, addr));
+}
 
-	// Format it
-	sprintf(addr,"%.8X",(unsigned int)crc);
-	return(addr);
+// Generate random MAC address, buffer needs MAC_STR_LEN
+char* mac_rand_r (unsigned int* seed, char* buffer)
+{
+	bdaddr_t addr;
+	int i;
+	
+	// Same range as mac_rand()
+	for (i = 0; i < 6; i++)
+		addr.b[i] = rand_r(seed) % 254;
+	
+	return(mac_format_r(&addr, buffer));
+}
+
+// Return MAC OUI segment, buffer needs MAC_OUI_LEN
+char* mac_get_oui_r (const bdaddr_t* addr, char* buffer)
+{
+	mac_write(addr, 3, ':', buffer);
+	return(buffer);
+}
+
+// Return MAC in hex notation, buffer needs MAC_STR_LEN
+char* mac_get_hex_r (const bdaddr_t* addr, char* buffer)
+{
+	mac_write(addr, 6, '-', buffer);
+	return(buffer);
+}
+
+// X out the device-specific part of MAC, buffer needs MAC_STR_LEN
+char* mac_obfuscate_r (const bdaddr_t* addr, char* buffer)
+{
+	mac_write(addr, 3, ':', buffer);
+	strcpy(buffer + 8, ":XX:XX:XX");
+	return(buffer);
+}
+
+// Encode MAC with CRC32, buffer needs MAC_ENCODE_LEN
+// Hashes the printed form, so results match mac_encode()
+char* mac_encode_r (const bdaddr_t* addr, char* buffer)
+{
+	char full_mac[MAC_STR_LEN];
+	
+	mac_format_r(addr, full_mac);
+	crc32_hex(mac_crc32(0, full_mac, 17), buffer);
+	return(buffer);
+}
+
+// Encode MAC with keyed hash for given epoch, buffer needs MAC_KEYED_LEN
+char* mac_keyed_r (const bdaddr_t* addr, uint64_t epoch, char* buffer)
+{
+	// Each thread keeps its own copy of the epoch key
+	static __thread uint64_t key[2];
+	static __thread uint64_t key_epoch;
+	static __thread unsigned int key_gen = 0;
+	
+	if (!mac_key_valid)
+	{
+		strcpy(buffer, "NO_KEY");
+		return(buffer);
+	}
+	
+	if (key_gen != mac_key_gen || key_epoch != epoch)
+	{
+		mac_key_derive(epoch, key);
+		key_epoch = epoch;
+		key_gen = mac_key_gen;
+	}
+	
+	mac_keyed_int(mac_to_int(addr), key, buffer);
+	return(buffer);
+}
+
+// Return vendor for binary MAC. String lives in the database, so no
+// buffer is needed, but the database must already be loaded.
+const char* mac_get_vendor_r (const bdaddr_t* addr)
+{
+	if (oui_names == NULL)
+		return("NO_OUI_FILE");
+	
+	return(mac_vendor_lookup(mac_to_int(addr)));
 }
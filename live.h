@@ -0,0 +1,132 @@
+/*
+ *  live.h - Shared definitions for Bluelog Live
+ *
+ *  Bluelog keeps an index next to the live log so livelog.cgi can find
+ *  records without reading the whole log. The index is a header followed
+ *  by one entry per record, in the order they were written. Bluelog
+ *  writes the entry before bumping the count in the header, so readers
+ *  never see an entry that isn't finished. Every so often Bluelog drops
+ *  older records for devices that were logged again, writing a new log
+ *  and index and renaming them over the old ones. The index records which
+ *  log it belongs to, so a reader that opens one of each can tell.
+ *
+ *  While it runs, Bluelog also publishes its device table and status in a
+ *  POSIX shared memory segment, so local readers can get at them without
+ *  parsing anything. Bluelog is the only writer and never waits on
+ *  readers. Each slot and the header have their own sequence number,
+ *  which is odd while Bluelog is changing them; readers copy what they
+ *  want and try again if the sequence number moved underneath them.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+#include <stdint.h>
+
+// Index file identification
+#define LIVE_IDX_MAGIC "BLLIVE"
+#define LIVE_IDX_VERSION 2
+
+// Start of index file
+struct live_idx_header
+{
+	char magic[8];
+	uint32_t version;
+	// Number of complete records in log
+	uint32_t count;
+	// Bytes of log covered by those records
+	uint64_t log_size;
+	// Inode of the log this index is for
+	uint64_t log_id;
+};
+
+// One per record
+struct live_idx_entry
+{
+	// Start of record in log
+	uint64_t offset;
+	// Time record was written
+	uint64_t epoch;
+};
+
+// Shared memory identification
+#define LIVE_SHM "/bluelog-live"
+#define LIVE_SHM_MAGIC "BLSHM"
+#define LIVE_SHM_VERSION 1
+
+// Field sizes, all text is terminated
+#define LIVE_SHM_TIME 20
+#define LIVE_SHM_ADDR 20
+#define LIVE_SHM_NAME 248
+#define LIVE_SHM_TEXT 128
+
+// Start of shared memory, followed by slots
+struct live_shm_header
+{
+	char magic[8];
+	uint32_t version;
+	// Number of slots after header
+	uint32_t slots;
+	// Odd while header is changing
+	uint32_t seq;
+	int32_t pid;
+	// Slots in use, and how many of those have been logged
+	uint32_t count;
+	uint32_t devices;
+	// Bumped whenever a slot changes
+	uint64_t generation;
+	// Times started, last slot change, and last scan
+	uint64_t started;
+	uint64_t updated;
+	uint64_t scanned;
+	// Scan counters
+	uint64_t scans;
+	uint64_t results;
+	// Status, info is the same pre-formatted HTML as the info file
+	char app_version[32];
+	char adapter[LIVE_SHM_ADDR];
+	char start_time[LIVE_SHM_TIME];
+	char info[512];
+};
+
+// One per device, in the same order as Bluelog's device cache
+struct live_shm_device
+{
+	// Odd while slot is changing
+	uint32_t seq;
+	// Non-zero once device has been logged
+	uint32_t logged;
+	uint64_t epoch;
+	uint64_t last_seen;
+	uint32_t seen;
+	// Same fields as live log record
+	char time[LIVE_SHM_TIME];
+	char addr[LIVE_SHM_ADDR];
+	char name[LIVE_SHM_NAME];
+	char class[LIVE_SHM_TEXT];
+	char info[LIVE_SHM_TEXT];
+};
+
+// Writer side, changes between these are hidden from readers
+static inline void live_write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void live_write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// Reader side, copy is good if live_read_end() returns zero
+static inline uint32_t live_read_begin(const uint32_t *seq)
+{
+	return(__atomic_load_n(seq, __ATOMIC_ACQUIRE));
+}
+
+static inline int live_read_end(const uint32_t *seq, uint32_t start)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return((start & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != start);
+}
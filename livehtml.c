@@ -0,0 +1,197 @@
+/*
+ *  livehtml.c - HTML output for Bluelog Live
+ *
+ *  Shared by livelog.cgi, which renders from the log files, and the web
+ *  server built into Bluelog, which renders from memory. Fields are passed
+ *  with their length so they can point straight into a mapped log.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+// Fields of one device record
+#define LIVE_FIELDS 5
+
+// Pointer and length, doesn't need to be terminated
+struct live_field
+{
+	const char *text;
+	int len;
+};
+
+// Field from regular string
+static inline struct live_field live_string(const char *text)
+{
+	struct live_field field = { text, strlen(text) };
+	return(field);
+}
+
+void html_header(FILE *out, const char *cssprefix, const char *cssfile, const char *appname, const char *version)
+{
+	// Boilerplate
+	fprintf(out, "<!--This file created with %s (v%s) by MS3FGX-->\n", appname, version);
+	// HTML head
+	fprintf(out, "<html><head><link href=\"%s%s\" type=\"text/css\" rel=\"stylesheet\" />", cssprefix, cssfile);
+	// Keeps the table current, see www/live.js
+	fprintf(out, "<script type=\"text/javascript\" src=\"%slive.js\"></script></head><body>\n", cssprefix);
+}
+
+void html_table(FILE *out, int mobile)
+{
+	// Table setup
+	fputs("<table border=\"1\" cellpadding=\"5\" cellspacing=\"5\" width=\"100%\">\n\n", out);
+	
+	if (!mobile)
+	{
+		fputs("<tr>\n"\
+		"<th>Time Discovered</th>\n"\
+		"<th>MAC Address</th>\n"\
+		"<th>Device Name</th>\n"\
+		"<th>Device Class</th>\n"\
+		"<th>Hardware Info</th>\n"\
+		"</tr>\n\n", out);
+	}
+	else
+	{
+		fputs("<tr>\n"\
+		"<th>Time</th>\n"\
+		"<th>MAC</th>\n"\
+		"<th>Name</th>\n"\
+		"<th>Class</th>\n"\
+		"</tr>\n\n", out);
+	}
+}
+
+// Time, MAC, name, class, and hardware info
+void html_row(FILE *out, int mobile, const struct live_field *fields)
+{
+	const struct live_field *name = &fields[2];
+	
+	// Write out valid table HTML
+	fprintf(out, "<tr>");
+	fprintf(out, "<td>%.*s</td>", fields[0].len, fields[0].text);
+	fprintf(out, "<td>%.*s</td>", fields[1].len, fields[1].text);
+	
+	// Before writing out device name to HTML, do some VERY basic sanitization (not safe, just to block obvious stuff)		
+	if (memchr(name->text, '>', name->len) || memmem(name->text, name->len, "</", 2))
+		fprintf(out, "<td><p style='color:red;'>Blocked Possible Exploit</p></td>");
+	else
+		fprintf(out, "<td>%.*s</td>", name->len, name->text);
+	
+	fprintf(out, "<td>%.*s</td>", fields[3].len, fields[3].text);
+	
+	if (!mobile)
+		fprintf(out, "<td>%.*s</td>", fields[4].len, fields[4].text);
+	
+	fprintf(out, "</tr>\n");
+}
+
+void html_topbar(FILE *out, int count)
+{
+	// Discovered devices display
+	fputs("<div id=\"content\">\n\n", out);
+	fprintf(out, "Discovered Devices: %i</div>\n", count);
+	// Close up info pane
+	fputs("</div>\n\n", out);	
+}
+
+// Info is pre-formatted sideitems, running is Bluelog status
+void html_sidebar(FILE *out, const char *info, int info_len, int running, int count)
+{	
+	// Start sidebar
+	fputs("<div id=\"sidebar\">\n\n", out);
+	
+	// Aux pane
+	fputs("<div id=\"sideobject\">\n"\
+	"<div id=\"auxbox1\">\n"\
+	"</div>\n"\
+	"</div>\n\n", out);
+	
+	// Start info pane
+	fputs("<div id=\"sideobject\">\n"\
+	"<div id=\"boxheader\">Info</div>\n"\
+	"<div id=\"sidebox\">\n"\
+	"<div id=\"sidecontent\">\n", out);
+	
+	// Populate sidebar
+	fwrite(info, 1, info_len, out);
+	
+	// Close info pane
+	fputs("</div>\n"\
+	"</div>\n"\
+	"</div>\n\n", out);
+	
+	// Status pane
+	fputs("<div id=\"sideobject\">\n"\
+	"<div id=\"boxheader\">Status</div>\n"\
+	"<div id=\"sidebox\">\n"\
+	"<div id=\"sidecontent\">\n", out);
+	
+	// Print current PID status
+	fputs("<div class=\"sideitem\">\n", out);
+	fputs("Bluelog: \n", out);	
+	if (running)
+		fputs("<span style=\"color: #00ff00;\"><b>RUNNING</b></span></div>\n\n", out);
+	else
+		fputs("<span style=\"color: #ff0000;\"><b>STOPPED</b></span></div>\n\n", out);	
+	
+	// Print number of discovered devices
+	fputs("<div class=\"sideitem\">\n", out);
+	fprintf(out, "Discovered Devices: %i</div>\n", count);
+	
+	// Close status pane
+	fputs("</div>\n"\
+	"</div>\n"\
+	"</div>\n\n", out);
+	
+	// Aux pane
+	fputs("<div id=\"sideobject\">\n"\
+	"<div id=\"auxbox2\">\n"\
+	"</div>\n"\
+	"</div>\n\n", out);
+	
+	// Close sidebar
+	fputs("</div>\n\n", out);
+}
+
+// Error message in page body
+void html_error(FILE *out, const char *message)
+{
+	fputs("<div id=\"content\">\n", out);
+	fprintf(out, "%s\n", message);
+	fputs("</body></html>\n", out);
+}
+
+// Links to neighbouring pages, link is the rest of the query string
+void html_pager(FILE *out, const char *link, int page, int more)
+{
+	if (page < 2 && !more)
+		return;
+
+	fputs("<div id=\"pager\">\n", out);
+	if (page > 1)
+		fprintf(out, "<a href=\"?%spage=%i\">Previous</a>\n", link, page - 1);
+	fprintf(out, "Page %i\n", page);
+	if (more)
+		fprintf(out, "<a href=\"?%spage=%i\">Next</a>\n", link, page + 1);
+	fputs("</div>\n", out);
+}
+
+// Content window with table, rows and anything after them come from callbacks
+void html_content(FILE *out, int mobile, int count, void (*rows)(FILE *out, int mobile), void (*footer)(FILE *out))
+{
+	fputs("<div id=\"content\">\n", out);
+	
+	if (count > 0)
+	{
+		// Print results
+		html_table(out, mobile);
+		rows(out, mobile);
+		fputs("</table>\n\n", out);
+		if (footer != NULL)
+			footer(out);
+	}
+	
+	// Close content, body, and HTML
+	fputs("</div></body></html>\n", out);
+}
@@ -0,0 +1,116 @@
+/*
+ *  livejson.c - JSON output for Bluelog Live
+ *
+ *  Everything is written straight to the output as records are read, so
+ *  nothing is built up in memory no matter how many devices are returned.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+// Member names for fields of device record, in log order
+static const char *json_names[LIVE_FIELDS] = { "time", "mac", "name", "class", "info" };
+
+// Length of the UTF-8 sequence at text, 0 if it isn't valid (overlong,
+// surrogate, past U+10FFFF or cut short)
+static int utf8_len(const unsigned char *text, const unsigned char *end)
+{
+	unsigned int c = text[0], min;
+	int len, i;
+
+	if (c < 0x80)
+		return(1);
+	else if ((c & 0xe0) == 0xc0)
+	{
+		len = 2;
+		min = 0x80;
+		c &= 0x1f;
+	}
+	else if ((c & 0xf0) == 0xe0)
+	{
+		len = 3;
+		min = 0x800;
+		c &= 0x0f;
+	}
+	else if ((c & 0xf8) == 0xf0)
+	{
+		len = 4;
+		min = 0x10000;
+		c &= 0x07;
+	}
+	else
+		return(0);
+
+	if (end - text < len)
+		return(0);
+	for (i = 1; i < len; i++)
+	{
+		if ((text[i] & 0xc0) != 0x80)
+			return(0);
+		c = (c << 6) | (text[i] & 0x3f);
+	}
+	if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+		return(0);
+	return(len);
+}
+
+// Quoted string, escaped as needed. Names come from remote devices and can
+// be any bytes, anything that isn't valid UTF-8 becomes U+FFFD.
+void json_string(FILE *out, const char *text, int len)
+{
+	const unsigned char *p = (const unsigned char *)text;
+	const unsigned char *end = p + len;
+	int n;
+
+	putc('"', out);
+	while (p < end)
+	{
+		if (*p == '"' || *p == '\\')
+		{
+			putc('\\', out);
+			putc(*p++, out);
+		}
+		else if (*p < 0x20)
+			fprintf(out, "\\u%04x", *p++);
+		else if ((n = utf8_len(p, end)) == 0)
+		{
+			fputs("\\ufffd", out);
+			p++;
+		}
+		else
+		{
+			fwrite(p, 1, n, out);
+			p += n;
+		}
+	}
+	putc('"', out);
+}
+
+// "key":"value", comma first unless it's the first member
+void json_member(FILE *out, int first, const char *key, const char *text, int len)
+{
+	if (!first)
+		putc(',', out);
+	json_string(out, key, strlen(key));
+	putc(':', out);
+	json_string(out, text, len);
+}
+
+// One device object, comma first unless it's the first in the list
+void json_device(FILE *out, int first, const struct live_field *fields)
+{
+	int f;
+
+	fputs(first ? "\n{" : ",\n{", out);
+	for (f = 0; f < LIVE_FIELDS; f++)
+		json_member(out, f == 0, json_names[f], fields[f].text, fields[f].len);
+	putc('}', out);
+}
+
+// Error object, for when there's nothing else to send
+void json_error(FILE *out, const char *message)
+{
+	fputs("{", out);
+	json_member(out, 1, "error", message, strlen(message));
+	fputs("}\n", out);
+}
@@ -5,21 +5,37 @@
  *  For more information, see: www.digifail.com
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "live.h"
+#include "livehtml.c"
+#include "livejson.c"
 
 // Defines
 #define APPNAME "livelog.cgi"
 #define VERSION "1.1"
 #define MAXNUM 4096
-#define MAXLINE 500
+#define LIMIT 100
+#define QUERY_LEN 64
 #define INFO "/tmp/info.txt"
 #define LOG "/tmp/live.log"
+#define INDEX "/tmp/live.idx"
 #define PID_FILE "/tmp/bluelog.pid"
 
 // Conditionals
@@ -31,25 +47,47 @@
 
 // Global variables
 int mobile;
-
-// Found device struct
-struct btdev
-{
-	char time[20];
-	char addr[18];
-	char name[248];
-	char class[248];
-	char hwinfo[248];
-};
+int json;
 
 // Global variables
-// Device file
-FILE *logfile;
 // Status file
 FILE *infofile; 
-// Init device cache, index
-struct btdev dev_cache[MAXNUM];
+// Device log and its index, mapped read-only
+const char *log_map;
+size_t log_size;
+const struct live_idx_entry *idx_entries;
+size_t idx_size;
+// Record offsets when there is no index, newest MAXNUM only
+uint64_t row_offsets[MAXNUM];
+// Number of records, and how many of them are devices to show
 int device_index = 0;
+int device_count = 0;
+// Bluelog's shared memory, used instead of files when it's there
+const struct live_shm_header *shm;
+const struct live_shm_device *shm_slots;
+size_t shm_size;
+// Copies of header and current record
+struct live_shm_header shm_status;
+struct live_shm_device shm_record;
+
+// Filters and paging from QUERY_STRING
+struct live_query
+{
+	int page;
+	int limit;
+	int oldest;
+	uint64_t since;
+	uint64_t until;
+	char mac[QUERY_LEN];
+	char class[QUERY_LEN];
+	char name[QUERY_LEN];
+	// Everything but the page, for page links
+	char link[QUERY_LEN * 12];
+	// Set if anything has to look at the record itself
+	int filter;
+	// Set if there is another page
+	int more;
+} query = { .page = 1, .limit = LIMIT, .until = UINT64_MAX };
 
 // Experimental, print all HTML from CGI module
 void print_html(char *CSSFILE)
@@ -96,89 +134,454 @@ void print_header(char *CSSFILE)
 {		
 	// CGI header
 	printf("Content-type: text/html\n\n");
-	// Boilerplate
-	printf("<!--This file created with %s (v%s) by MS3FGX-->\n", APPNAME, VERSION);
-	// HTML head
-	printf("<html><head><link href=\"%s%s\" type=\"text/css\" rel=\"stylesheet\" /></head><body>\n", CSSPREFIX,CSSFILE);
+	html_header(stdout, CSSPREFIX, CSSFILE, APPNAME, VERSION);
+}
+
+// Read pre-formatted info from Bluelog, returns length
+int read_info(char *info, int size)
+{
+	return(fread(info, 1, size, infofile));
 }
 
-void setup_table()
+// Decode %XX and + in place
+void url_decode(char *text)
 {
-	// Table setup
-	puts("<table border=\"1\" cellpadding=\"5\" cellspacing=\"5\" width=\"100%\">\n");
+	char *out = text;
+	unsigned int value;
 	
-	if (!mobile)
+	for (; *text; text++, out++)
 	{
-		puts("<tr>\n"\
-		"<th>Time Discovered</th>\n"\
-		"<th>MAC Address</th>\n"\
-		"<th>Device Name</th>\n"\
-		"<th>Device Class</th>\n"\
-		"<th>Hardware Info</th>\n"\
-		"</tr>\n");
+		if (*text == '+')
+			*out = ' ';
+		else if (*text == '%' && isxdigit((unsigned char)text[1]) && isxdigit((unsigned char)text[2]) &&
+			sscanf(text + 1, "%2x", &value) == 1)
+		{
+			*out = value;
+			text += 2;
+		}
+		else
+			*out = *text;
 	}
-	else
+	*out = '\0';
+}
+
+// Add parameter to page links, encoding anything that isn't plain
+void query_link(const char *key, const char *value)
+{
+	size_t len = strlen(query.link);
+	
+	len += snprintf(query.link + len, sizeof(query.link) - len, "%s=", key);
+	for (; *value && len < sizeof(query.link) - 8; value++)
 	{
-		puts("<tr>\n"\
-		"<th>Time</th>\n"\
-		"<th>MAC</th>\n"\
-		"<th>Name</th>\n"\
-		"<th>Class</th>\n"\
-		"</tr>\n");
+		if (isalnum((unsigned char)*value) || strchr("-_.:", *value))
+			query.link[len++] = *value;
+		else
+			len += sprintf(query.link + len, "%%%02X", (unsigned char)*value);
 	}
+	snprintf(query.link + len, sizeof(query.link) - len, "&amp;");
 }
 
-void print_info()
+// Read parameters from QUERY_STRING, unknown ones are ignored
+void parse_query(const char *env_string)
 {
-	// Line length
-	char line [128];
+	char buffer[1024];
+	char *pair, *value, *save;
+	
+	strncpy(buffer, env_string, sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = '\0';
+	
+	for (pair = strtok_r(buffer, "&", &save); pair != NULL; pair = strtok_r(NULL, "&", &save))
+	{
+		if ((value = strchr(pair, '=')) != NULL)
+		{
+			*value++ = '\0';
+			url_decode(value);
+		}
+		else
+			value = "";
+	
+		if (!strcmp(pair, "page"))
+		{
+			// Not part of link, each link sets its own
+			query.page = atoi(value);
+			if (query.page < 1 || query.page > INT_MAX / MAXNUM)
+				query.page = 1;
+			continue;
+		}
+		else if (!strcmp(pair, "limit"))
+		{
+			query.limit = atoi(value);
+			if (query.limit < 1 || query.limit > MAXNUM)
+				query.limit = MAXNUM;
+		}
+		else if (!strcmp(pair, "sort"))
+			query.oldest = !strcmp(value, "oldest");
+		else if (!strcmp(pair, "since"))
+			query.since = strtoull(value, NULL, 10);
+		else if (!strcmp(pair, "until"))
+			query.until = strtoull(value, NULL, 10);
+		else if (!strcmp(pair, "minutes"))
+			query.since = time(NULL) - strtoull(value, NULL, 10) * 60;
+		else if (!strcmp(pair, "mac"))
+			snprintf(query.mac, QUERY_LEN, "%s", value);
+		else if (!strcmp(pair, "class"))
+			snprintf(query.class, QUERY_LEN, "%s", value);
+		else if (!strcmp(pair, "name"))
+			snprintf(query.name, QUERY_LEN, "%s", value);
+		else if (!strcmp(pair, "format"))
+			json = !strcmp(value, "json");
+		else if (!strcmp(pair, "mobile") || !strcmp(pair, "-m"))
+		{
+			mobile = 1;
+			pair = "mobile";
+			value = "1";
+		}
+		else
+			continue;
 	
-	while (fgets(line,sizeof line,infofile))
-		fputs(line,stdout);
+		query_link(pair, value);
+	}
+	
+	query.filter = query.mac[0] || query.class[0] || query.name[0];
 }
 
-void read_log()
+// Map whole file read-only, empty files give NULL. Inode goes in id if
+// it's not NULL.
+const void* map_file(const char *filename, size_t *size, uint64_t *id)
 {
-	char line [MAXLINE];	
-	while (fgets(line,sizeof line,logfile))
+	struct stat st;
+	void *map;
+	int fd;
+	
+	*size = 0;
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return(NULL);
+	
+	if (fstat(fd, &st) < 0 || st.st_size == 0)
 	{
-		// Copy line to buffer
-		char* line_buffer = strdup(line);
-	
-		// Populate cache entry from file
-		strcpy(dev_cache[device_index].time,strsep(&line_buffer, ","));	
-		strcpy(dev_cache[device_index].addr,strsep(&line_buffer, ","));	
-		strcpy(dev_cache[device_index].name,strsep(&line_buffer, ","));
-		strcpy(dev_cache[device_index].class,strsep(&line_buffer, ","));
-		strcpy(dev_cache[device_index].hwinfo,strsep(&line_buffer, "\n"));
-		
-        // Increment index
-		device_index++;
+		close(fd);
+		return(NULL);
 	}
+	
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return(NULL);
+	
+	*size = st.st_size;
+	if (id != NULL)
+		*id = st.st_ino;
+	return(map);
 }
 
-void print_devices()
+// Use index from Bluelog to find records, returns non-zero if unusable
+int read_index(const char *indexfilename, uint64_t log_id)
 {
-	while (device_index > 0)
-	{	
-		// Write out valid table HTML
-		printf("<tr>");
-		printf("<td>%s</td>",dev_cache[device_index-1].time);		
-		printf("<td>%s</td>",dev_cache[device_index-1].addr);	
-		
-		// Before writing out device name to HTML, do some VERY basic sanitization (not safe, just to block obvious stuff)		
-		if ((strstr(dev_cache[device_index-1].name, ">")) || (strstr(dev_cache[device_index-1].name, "</")))
-			strcpy(dev_cache[device_index-1].name, "<p style='color:red;'>Blocked Possible Exploit</p>");
+	const struct live_idx_header *header;
+	const void *map;
+	size_t max;
+	
+	if ((map = map_file(indexfilename, &idx_size, NULL)) == NULL)
+		return(1);
+	
+	header = map;
+	if (idx_size < sizeof(*header) || strcmp(header->magic, LIVE_IDX_MAGIC) ||
+		header->version != LIVE_IDX_VERSION || header->log_id != log_id)
+	{
+		munmap((void*)map, idx_size);
+		return(1);
+	}
+	
+	// Only trust entries that made it into both files
+	idx_entries = (const struct live_idx_entry*)(header + 1);
+	max = (idx_size - sizeof(*header)) / sizeof(struct live_idx_entry);
+	device_index = (header->count < max) ? header->count : max;
+	while (device_index > 0 && idx_entries[device_index - 1].offset >= log_size)
+		device_index--;
+	
+	return(0);
+}
 
-		printf("<td>%s</td>",dev_cache[device_index-1].name);	
-		printf("<td>%s</td>",dev_cache[device_index-1].class);	
-		
-		if(!mobile)
-			printf("<td>%s</td>",dev_cache[device_index-1].hwinfo);	
+// No index, so walk the log and remember where the newest records start
+void scan_log()
+{
+	const char *line = log_map, *end = log_map + log_size, *next;
+	
+	while (line < end)
+	{
+		row_offsets[device_index % MAXNUM] = line - log_map;
+		device_index++;
 		
-		printf("</tr>\n");
-		device_index--;
+		if ((next = memchr(line, '\n', end - line)) == NULL)
+			break;
+		line = next + 1;
+	}
+}
+
+void read_log(const char *logfilename, const char *indexfilename)
+{
+	uint64_t log_id;
+	
+	// Log may have been compacted since the index was opened
+	log_map = map_file(logfilename, &log_size, &log_id);
+	if (log_map != NULL && read_index(indexfilename, log_id))
+		scan_log();
+	device_count = device_index;
+}
+
+// Consistent copy of something Bluelog might be changing, non-zero on failure
+int shm_copy(void *copy, const void *source, size_t size, const uint32_t *seq)
+{
+	uint32_t start;
+	int tries;
+	
+	// Bluelog only holds a slot for a moment, don't wait forever if it died
+	for (tries = 0; tries < 1000; tries++)
+	{
+		start = live_read_begin(seq);
+		memcpy(copy, source, size);
+		if (!live_read_end(seq, start))
+			return(0);
+	}
+	return(1);
+}
+
+// Use Bluelog's shared memory, returns non-zero if it isn't there or stale
+int read_shm()
+{
+	const struct live_shm_header *header;
+	struct stat st;
+	void *map;
+	int fd;
+	
+	if ((fd = shm_open(LIVE_SHM, O_RDONLY, 0)) < 0)
+		return(1);
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*header))
+	{
+		close(fd);
+		return(1);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return(1);
+	
+	// Bluelog removes it on exit, but could have been killed
+	header = map;
+	if (shm_copy(&shm_status, header, sizeof(shm_status), &header->seq) ||
+		strcmp(shm_status.magic, LIVE_SHM_MAGIC) || shm_status.version != LIVE_SHM_VERSION ||
+		st.st_size < sizeof(*header) + (size_t)shm_status.slots * sizeof(struct live_shm_device) ||
+		shm_status.count > shm_status.slots ||
+		(kill(shm_status.pid, 0) < 0 && errno != EPERM))
+	{
+		munmap(map, st.st_size);
+		return(1);
 	}
+	
+	shm = header;
+	shm_slots = (const struct live_shm_device*)(header + 1);
+	shm_size = st.st_size;
+	device_index = shm_status.count;
+	device_count = shm_status.devices;
+	return(0);
+}
+
+// Pull next field out of record, returns length
+int next_field(const char **field, const char **line, const char *end, char sep)
+{
+	const char *stop;
+	
+	*field = *line;
+	if ((stop = memchr(*line, sep, end - *line)) == NULL)
+		stop = end;
+	
+	*line = (stop < end) ? stop + 1 : end;
+	return(stop - *field);
+}
+
+// Fields straight from shared memory, returns zero if not logged
+int read_slot(int i, struct live_field *fields)
+{
+	if (shm_copy(&shm_record, &shm_slots[i], sizeof(shm_record), &shm_slots[i].seq) || !shm_record.logged)
+		return(0);
+	
+	fields[0] = live_string(shm_record.time);
+	fields[1] = live_string(shm_record.addr);
+	fields[2] = live_string(shm_record.name);
+	fields[3] = live_string(shm_record.class);
+	fields[4] = live_string(shm_record.info);
+	return(1);
+}
+
+// Split record into fields, last field is everything that's left. Returns
+// zero if there's no record to show.
+int read_record(int i, struct live_field *fields)
+{
+	const char *line, *end;
+	uint64_t offset;
+	int f;
+	
+	if (shm)
+		return(read_slot(i, fields));
+	
+	offset = idx_entries ? idx_entries[i].offset : row_offsets[i % MAXNUM];
+	line = log_map + offset;
+	if ((end = memchr(line, '\n', log_size - offset)) == NULL)
+		end = log_map + log_size;
+	
+	for (f = 0; f < LIVE_FIELDS; f++)
+		fields[f].len = next_field(&fields[f].text, &line, end, (f < LIVE_FIELDS - 1) ? ',' : '\n');
+	return(1);
+}
+
+// When record was logged, from the time field if there's no index
+uint64_t record_epoch(int i, const struct live_field *fields)
+{
+	char stamp[20];
+	struct tm tm;
+	
+	if (shm)
+		return(shm_record.epoch);
+	if (idx_entries)
+		return(idx_entries[i].epoch);
+	
+	memset(&tm, 0, sizeof(tm));
+	snprintf(stamp, sizeof(stamp), "%.*s", fields[0].len, fields[0].text);
+	if (strptime(stamp, "%D %T", &tm) == NULL)
+		return(0);
+	tm.tm_isdst = -1;
+	return(mktime(&tm));
+}
+
+// First record logged at or after epoch, index is in logging order
+int find_epoch(uint64_t epoch)
+{
+	int low = 0, high = device_index, mid;
+	
+	while (low < high)
+	{
+		mid = low + (high - low) / 2;
+		if (idx_entries[mid].epoch < epoch)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return(low);
+}
+
+// Case insensitive search within field
+int field_contains(const struct live_field *field, const char *text)
+{
+	int len = strlen(text), i;
+	
+	for (i = 0; i + len <= field->len; i++)
+		if (!strncasecmp(field->text + i, text, len))
+			return(1);
+	return(0);
+}
+
+// MAC starts with prefix, ':' and '-' are the same thing
+int field_prefix(const struct live_field *field, const char *prefix)
+{
+	int i;
+	
+	for (i = 0; prefix[i]; i++)
+	{
+		if (i >= field->len)
+			return(0);
+		if (prefix[i] == '-' || prefix[i] == ':')
+		{
+			if (field->text[i] != '-' && field->text[i] != ':')
+				return(0);
+		}
+		else if (toupper((unsigned char)prefix[i]) != toupper((unsigned char)field->text[i]))
+			return(0);
+	}
+	return(1);
+}
+
+int record_matches(int i, const struct live_field *fields)
+{
+	uint64_t epoch;
+	
+	// Index already narrowed the time window
+	if (!idx_entries && (query.since || query.until != UINT64_MAX))
+	{
+		epoch = record_epoch(i, fields);
+		if (epoch < query.since || epoch > query.until)
+			return(0);
+	}
+	
+	if (query.mac[0] && !field_prefix(&fields[1], query.mac))
+		return(0);
+	if (query.name[0] && !field_contains(&fields[2], query.name))
+		return(0);
+	if (query.class[0] && !field_contains(&fields[3], query.class))
+		return(0);
+	return(1);
+}
+
+void print_devices(FILE *out, int mobile)
+{
+	struct live_field fields[LIVE_FIELDS];
+	int first, last, step, i, skip, shown = 0;
+	
+	// Without an index, only the newest MAXNUM can be found
+	first = (shm || idx_entries) ? 0 : (device_index > MAXNUM ? device_index - MAXNUM : 0);
+	last = device_index;
+	
+	// Time window straight from the index
+	if (idx_entries)
+	{
+		if (query.since)
+			first = find_epoch(query.since);
+		if (query.until != UINT64_MAX)
+			last = find_epoch(query.until + 1);
+	}
+	
+	// Records before this page
+	skip = (query.page - 1) * query.limit;
+	
+	// Newest first unless asked otherwise
+	step = query.oldest ? 1 : -1;
+	i = query.oldest ? first : last - 1;
+	
+	// Nothing to check, so just jump to the page. Not every slot in
+	// shared memory has been logged, so those have to be checked.
+	if (!query.filter && !shm && (idx_entries || (!query.since && query.until == UINT64_MAX)))
+	{
+		i += step * skip;
+		skip = 0;
+	}
+	
+	for (; i >= first && i < last; i += step)
+	{
+		if (!read_record(i, fields) || !record_matches(i, fields))
+			continue;
+	
+		if (skip > 0)
+		{
+			skip--;
+			continue;
+		}
+	
+		if (shown == query.limit)
+		{
+			query.more = 1;
+			break;
+		}
+	
+		if (json)
+			json_device(out, shown == 0, fields);
+		else
+			html_row(out, mobile, fields);
+		shown++;
+	}
+}
+
+void print_pager(FILE *out)
+{
+	html_pager(out, query.link, query.page, query.more);
 }
 
 int read_pid()
@@ -199,76 +602,146 @@ int read_pid()
 
 void TopBar()
 {
-	// Discovered devices display
-	puts("<div id=\"content\">\n");
-	printf("Discovered Devices: %i</div>\n",device_index);
-	// Close up info pane
-	puts("</div>\n");	
+	html_topbar(stdout, device_count);
 }
 
 void SideBar()
 {	
-	// Start sidebar
-	puts("<div id=\"sidebar\">\n");
-	
-	// Aux pane
-	puts("<div id=\"sideobject\">\n"\
-	"<div id=\"auxbox1\">\n"\
-	"</div>\n"\
-	"</div>\n");
-	
-	// Start info pane
-	puts("<div id=\"sideobject\">\n"\
-	"<div id=\"boxheader\">Info</div>\n"\
-	"<div id=\"sidebox\">\n"\
-	"<div id=\"sidecontent\">");
-	
-	// Populate sidebar from files
-	print_info();
-	
-	// Close info pane
-	puts("</div>\n"\
-	"</div>\n"\
-	"</div>\n");
-	
-	// Status pane
-	puts("<div id=\"sideobject\">\n"\
-	"<div id=\"boxheader\">Status</div>\n"\
-	"<div id=\"sidebox\">\n"\
-	"<div id=\"sidecontent\">");
-	
-	// Print current PID status
-	puts("<div class=\"sideitem\">");
-	puts("Bluelog: ");	
-	if (read_pid() != 0)
-		puts("<span style=\"color: #00ff00;\"><b>RUNNING</b></span></div>\n");
+	char info[4096];
+	
+	// Bluelog has to be running for shared memory to be used
+	if (shm)
+		html_sidebar(stdout, shm_status.info, strnlen(shm_status.info, sizeof(shm_status.info)), 1, device_count);
 	else
-		puts("<span style=\"color: #ff0000;\"><b>STOPPED</b></span></div>\n");	
+		html_sidebar(stdout, info, read_info(info, sizeof(info)), read_pid() != 0, device_count);
+}
+
+// Status items from info file, each sideitem is "Label: value"
+void json_info(FILE *out, const char *info, int info_len)
+{
+	static const char *labels[][2] = {
+		{ "Version: ", "version" },
+		{ "Device: ", "adapter" },
+		{ "Started: ", "started" }
+	};
+	const char *item = info, *end = info + info_len, *stop, *value;
+	int i;
 	
-	// Print number of discovered devices
-	puts("<div class=\"sideitem\">");
-	printf("Discovered Devices: %i</div>\n",device_index);
+	while ((item = memmem(item, end - item, "sideitem\">", 10)) != NULL)
+	{
+		item += 10;
+		if ((stop = memmem(item, end - item, "</div>", 6)) == NULL)
+			break;
+		
+		for (i = 0; i < sizeof(labels) / sizeof(labels[0]); i++)
+		{
+			if ((value = memmem(item, stop - item, labels[i][0], strlen(labels[i][0]))) == NULL)
+				continue;
+			value += strlen(labels[i][0]);
+			json_member(out, 0, labels[i][1], value, stop - value);
+			break;
+		}
+		item = stop;
+	}
+}
+
+// Check conditional request, If-None-Match wins if both were sent
+int not_modified(const char *etag, time_t modified)
+{
+	const char *match = getenv("HTTP_IF_NONE_MATCH");
+	const char *since = getenv("HTTP_IF_MODIFIED_SINCE");
+	struct tm tm;
 	
-	// Close status pane
-	puts("</div>\n"\
-	"</div>\n"\
-	"</div>\n");
+	if (match)
+		return(strstr(match, etag) || !strcmp(match, "*"));
 	
-	// Aux pane
-	puts("<div id=\"sideobject\">\n"\
-	"<div id=\"auxbox2\">\n"\
-	"</div>\n"\
-	"</div>\n");
+	memset(&tm, 0, sizeof(tm));
+	return(since && strptime(since, "%a, %d %b %Y %H:%M:%S GMT", &tm) && timegm(&tm) >= modified);
+}
+
+// Devices and status as JSON. Unchanged logs get 304 without being read.
+void print_json(const char *infofilename, const char *logfilename, const char *indexfilename)
+{
+	char etag[64], modified[64], info[4096];
+	struct stat st;
+	time_t changed;
+	int pid;
+	
+	if (shm)
+	{
+		// Shared memory counts its own changes, slots by generation and
+		// status (scans, results) by the header sequence
+		pid = shm_status.pid;
+		changed = shm_status.updated ? shm_status.updated : shm_status.started;
+		if (shm_status.scanned > changed)
+			changed = shm_status.scanned;
+		snprintf(etag, sizeof(etag), "\"shm-%x-%llx-%x\"", pid, (unsigned long long)shm_status.generation,
+			shm_status.seq);
+	}
+	else
+	{
+		if ((infofile = fopen(infofilename, "r")) == NULL || stat(logfilename, &st) < 0)
+		{
+			syslog(LOG_ERR,"Error while opening %s!", infofile ? logfilename : infofilename);
+			printf("Status: 503 Service Unavailable\n");
+			printf("Content-type: application/json\n\n");
+			json_error(stdout, "Bluelog Live is not running");
+			exit(1);
+		}
+		
+		// Log only changes by growing or being replaced, PID covers status
+		pid = read_pid();
+		changed = st.st_mtime;
+		snprintf(etag, sizeof(etag), "\"%llx-%llx.%lx-%x\"", (unsigned long long)st.st_size,
+			(unsigned long long)st.st_mtim.tv_sec, (unsigned long)st.st_mtim.tv_nsec, pid);
+	}
+	strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&changed));
 	
-	// Close sidebar
-	puts("</div>\n");
+	if (not_modified(etag, changed))
+	{
+		printf("Status: 304 Not Modified\n");
+		printf("ETag: %s\n", etag);
+		printf("Last-Modified: %s\n\n", modified);
+		return;
+	}
+	
+	printf("Content-type: application/json\n");
+	printf("ETag: %s\n", etag);
+	printf("Last-Modified: %s\n", modified);
+	printf("Cache-Control: no-cache\n\n");
+	
+	// Status first, then devices as they are found
+	printf("{\"bluelog\":{\"running\":%s", pid ? "true" : "false");
+	if (pid)
+		printf(",\"pid\":%i", pid);
+	if (shm)
+	{
+		json_member(stdout, 0, "version", shm_status.app_version, strnlen(shm_status.app_version, sizeof(shm_status.app_version)));
+		json_member(stdout, 0, "adapter", shm_status.adapter, strnlen(shm_status.adapter, sizeof(shm_status.adapter)));
+		json_member(stdout, 0, "started", shm_status.start_time, strnlen(shm_status.start_time, sizeof(shm_status.start_time)));
+		printf(",\"scans\":%llu,\"results\":%llu", (unsigned long long)shm_status.scans, (unsigned long long)shm_status.results);
+	}
+	else
+	{
+		read_log(logfilename, indexfilename);
+		json_info(stdout, info, read_info(info, sizeof(info)));
+	}
+	printf("},\n\"count\":%i,\"page\":%i,\"limit\":%i,\n\"devices\":[", device_count, query.page, query.limit);
+	print_devices(stdout, 0);
+	printf("\n],\n\"more\":%s}\n", query.more ? "true" : "false");
 }
 
 void shut_down(void)
 {
 	// Close files
-	fclose(infofile);
-	fclose(logfile);
+	if (infofile != NULL)
+		fclose(infofile);
+	if (log_map != NULL)
+		munmap((void*)log_map, log_size);
+	if (idx_entries != NULL)
+		munmap((void*)((const struct live_idx_header*)idx_entries - 1), idx_size);
+	if (shm != NULL)
+		munmap((void*)shm, shm_size);
 	exit(1);
 }
 
@@ -284,10 +757,21 @@ static void help(void)
 	printf("\n");
 	printf("Options:\n"
 		"\t-m              Mobile format\n"
+		"\t-j              JSON output\n"
 		"\t-h              Display help\n"
 		"\t-d              Print Debug Info\n"
 		"\t-v              Print Version Info\n"		
 		"\n");
+	printf("Query string:\n"
+		"\tpage, limit     Page number and devices per page (%i)\n"
+		"\tsort=oldest     Show oldest devices first\n"
+		"\tsince, until    Time window, seconds since the epoch\n"
+		"\tminutes         Only devices from the last number of minutes\n"
+		"\tmac             MAC or OUI prefix\n"
+		"\tclass, name     Text in device class or name\n"
+		"\tmobile          Mobile format\n"
+		"\tformat=json     JSON output\n"
+		"\n", LIMIT);
 }
 
 static void debug(void)
@@ -296,12 +780,14 @@ printf("System Variables\n");
 printf("--------------------------\n");
 printf("Module Version: %s\n", VERSION);
 printf("Max Devices: %i\n",MAXNUM);
-printf("Max Line Length: %i\n",MAXLINE);
+printf("Devices Per Page: %i\n",LIMIT);
 printf("\n");
 printf("File Locations\n");
 printf("--------------------------\n");
 printf("Info File: %s\n",INFO);
 printf("Log File: %s\n", LOG);
+printf("Index File: %s\n", INDEX);
+printf("Shared Memory: %s\n", LIVE_SHM);
 printf("CSS Prefix: %s\n",CSSPREFIX);
 }
 
@@ -310,6 +796,7 @@ static struct option main_options[] = {
 	{ "debug", 0, 0, 'd' },
 	{ "version", 0, 0, 'v' },
 	{ "mobile", 0, 0, 'm' },
+	{ "json", 0, 0, 'j' },
 	{ 0, 0, 0, 0 }
 };
  
@@ -322,10 +809,11 @@ int main(int argc, char *argv[])
 	// Pointers to filenames
 	char *infofilename = INFO;
 	char *logfilename = LOG;
+	char *indexfilename = INDEX;
 	
 	// Handle arguments
 	int opt;
-	while ((opt=getopt_long(argc, argv, "dvhm", main_options, NULL)) != EOF)
+	while ((opt=getopt_long(argc, argv, "dvhmj", main_options, NULL)) != EOF)
 	{
 		switch (opt)
 		{
@@ -343,18 +831,37 @@ int main(int argc, char *argv[])
 			strcpy(CSSFILE, "mobile.css");
 			mobile = 1;
 			break;
+		case 'j':
+			json = 1;
+			break;
 		default:
 			printf("Unknown option.\n");
 			exit(0);
 		}
 	}
 	
+	// Read in environment variable
+	char* env_string;
+	env_string=getenv("QUERY_STRING");
+	if (env_string != NULL)
+		parse_query(env_string);
+	if (mobile)
+		strcpy(CSSFILE, "mobile.css");
+	
 	// Bail out if we are root, except on WRT
 	#ifndef OPENWRT
 	if(getuid() == 0)
 	{
 		syslog(LOG_ERR,"CGI module refusing to run as root!");
 		
+		if (json)
+		{
+			printf("Status: 500 Internal Server Error\n");
+			printf("Content-type: application/json\n\n");
+			json_error(stdout, "CGI module refusing to run as root");
+			exit(1);
+		}
+		
 		// Make sure error message is themed
 		print_header(CSSFILE);
 		puts("<div id=\"content\">");
@@ -366,11 +873,16 @@ int main(int argc, char *argv[])
 	}
 	#endif
 
-	// Read in environment variable
-	// Comment this to fix compiler warning until ready to implement
-	//char* env_string;
-	//env_string=getenv("QUERY_STRING");
-
+	// Bluelog's shared memory if it's running, files otherwise
+	read_shm();
+	
+	// No HTML at all for JSON
+	if (json)
+	{
+		print_json(infofilename, logfilename, indexfilename);
+		shut_down();
+	}
+	
 	// Print HTML head
 	print_header(CSSFILE);
 	//print_html(CSSFILE);
@@ -380,7 +892,7 @@ int main(int argc, char *argv[])
 		puts("<div id=\"container\">\n");
 
 	// Open files
-	if ((infofile = fopen(infofilename, "r")) == NULL)
+	if (shm == NULL && (infofile = fopen(infofilename, "r")) == NULL)
 	{
 		syslog(LOG_ERR,"Error while opening %s!",infofilename);
 		puts("<div id=\"content\">");
@@ -389,7 +901,8 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 	
-	if ((logfile = fopen(logfilename, "r")) == NULL)
+	// Map log, or note why we can't
+	if (shm == NULL && access(logfilename, R_OK) != 0)
 	{
 		syslog(LOG_ERR,"Error while opening %s!",logfilename);
 		puts("<div id=\"content\">");
@@ -399,25 +912,15 @@ int main(int argc, char *argv[])
 	}
 	
 	// Draw sidebar\topbar
-	read_log();
+	if (shm == NULL)
+		read_log(logfilename, indexfilename);
 	if (!mobile)
 		SideBar();
 	else
 		TopBar();
 	
 	// Content window
-	puts("<div id=\"content\">");
-	
-	if (device_index > 0)
-	{
-		// Print results
-		setup_table();
-		print_devices();
-		puts("</table>\n");
-	}
-	
-	// Close content, body, and HTML
-	puts("</div></body></html>");
+	html_content(stdout, mobile, device_count, print_devices, print_pager);
 	
 	// Close files and exit
 	shut_down();
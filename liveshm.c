@@ -0,0 +1,148 @@
+/*
+ *  liveshm.c - Publish Bluelog Live data in shared memory
+ *
+ *  Keeps a copy of the device cache and scan status in a POSIX shared
+ *  memory segment (see live.h for the layout), so livelog.cgi and other
+ *  local tools can read it without going through the files in /tmp. Only
+ *  the scan loop writes to the segment, readers never hold it up.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+#include <sys/mman.h>
+
+// Mapped segment, NULL if not in use
+struct live_shm_header *live_shm = NULL;
+struct live_shm_device *live_shm_slots;
+size_t live_shm_size;
+
+// Create segment, Bluelog Live still works from files if this fails
+void live_shm_open (void)
+{
+	int fd;
+
+	if (!config.quiet)
+		printf("Creating shared memory: %s...", LIVE_SHM);
+
+	live_shm_size = sizeof(struct live_shm_header) + MAX_DEV * sizeof(struct live_shm_device);
+	fd = shm_open(LIVE_SHM, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, live_shm_size) < 0 ||
+		(live_shm = mmap(NULL, live_shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		if (!config.quiet)
+			printf("Failed, using files only\n");
+		syslog(LOG_ERR,"Unable to create shared memory, Bluelog Live will use files only.");
+		if (fd >= 0)
+		{
+			close(fd);
+			shm_unlink(LIVE_SHM);
+		}
+		live_shm = NULL;
+		return;
+	}
+	close(fd);
+
+	// New segment is all zeros, readers check magic first
+	live_shm_slots = (struct live_shm_device*)(live_shm + 1);
+	live_shm->version = LIVE_SHM_VERSION;
+	live_shm->slots = MAX_DEV;
+
+	if (!config.quiet)
+		printf("OK\n");
+}
+
+// Status that doesn't change during scan, PID is only final after daemonizing
+void live_shm_status (const char *start_time)
+{
+	if (live_shm == NULL)
+		return;
+
+	live_write_begin(&live_shm->seq);
+	live_shm->pid = getpid();
+	live_shm->started = time(NULL);
+	snprintf(live_shm->app_version, sizeof(live_shm->app_version), "%s%s", VERSION, VER_MOD);
+	snprintf(live_shm->adapter, sizeof(live_shm->adapter), "%s", config.addr);
+	snprintf(live_shm->start_time, sizeof(live_shm->start_time), "%s", start_time);
+	snprintf(live_shm->info, sizeof(live_shm->info), "%s", live_info);
+	strcpy(live_shm->magic, LIVE_SHM_MAGIC);
+	live_write_end(&live_shm->seq);
+}
+
+// Count finished scan
+void live_shm_scan (int num_results)
+{
+	if (live_shm == NULL)
+		return;
+
+	live_write_begin(&live_shm->seq);
+	live_shm->scans++;
+	if (num_results > 0)
+		live_shm->results += num_results;
+	live_shm->scanned = time(NULL);
+	live_write_end(&live_shm->seq);
+}
+
+// Copy device from cache into its slot
+void live_shm_device (int index)
+{
+	struct live_shm_device *slot;
+	struct live_field fields[LIVE_FIELDS];
+	int logged, was_logged;
+
+	if (live_shm == NULL)
+		return;
+
+	slot = &live_shm_slots[index];
+	logged = (dev_cache[index].print == 0);
+	// Slots past count are left over from before a reset
+	was_logged = (index < live_shm->count) ? slot->logged : 0;
+	live_fields(index, fields);
+
+	live_write_begin(&slot->seq);
+	slot->epoch = dev_cache[index].epoch;
+	slot->last_seen = dev_cache[index].last_seen;
+	slot->seen = dev_cache[index].seen;
+	snprintf(slot->time, sizeof(slot->time), "%.*s", fields[0].len, fields[0].text);
+	snprintf(slot->addr, sizeof(slot->addr), "%.*s", fields[1].len, fields[1].text);
+	snprintf(slot->name, sizeof(slot->name), "%.*s", fields[2].len, fields[2].text);
+	snprintf(slot->class, sizeof(slot->class), "%.*s", fields[3].len, fields[3].text);
+	snprintf(slot->info, sizeof(slot->info), "%.*s", fields[4].len, fields[4].text);
+
+	// Header covers count, so readers never look at a slot before it's done
+	live_write_begin(&live_shm->seq);
+	live_shm->devices += logged - was_logged;
+	slot->logged = logged;
+	if (index >= live_shm->count)
+		live_shm->count = index + 1;
+	live_shm->generation++;
+	live_shm->updated = time(NULL);
+	live_write_end(&live_shm->seq);
+
+	live_write_end(&slot->seq);
+}
+
+// Device cache was cleared
+void live_shm_reset (void)
+{
+	if (live_shm == NULL)
+		return;
+
+	// Old slots stay as they are until they get used again
+	live_write_begin(&live_shm->seq);
+	live_shm->count = 0;
+	live_shm->devices = 0;
+	live_shm->generation++;
+	live_shm->updated = time(NULL);
+	live_write_end(&live_shm->seq);
+}
+
+void live_shm_close (void)
+{
+	if (live_shm == NULL)
+		return;
+
+	munmap(live_shm, live_shm_size);
+	shm_unlink(LIVE_SHM);
+	live_shm = NULL;
+}
@@ -0,0 +1,281 @@
+/*
+ *  metrics.c - Counters and histograms for the scan loop
+ *
+ *  Every thread that records metrics has its own block, so updates on the
+ *  hot path are plain increments with no locking or atomics. Once per scan
+ *  cycle the block is copied into a shared slot, and exports add up all
+ *  the slots. Metrics are available in Prometheus text format:
+ *
+ *    - Written to METRICSFILE (or --metrics), replaced atomically
+ *    - From the built-in web server at /metrics
+ *    - To subscribers on the Unix socket that send METRICS
+ */
+
+#include <pthread.h>
+
+// Threads that can publish, and buckets per histogram (plus +Inf)
+#define METRICS_THREADS 4
+#define METRICS_BUCKETS 10
+
+// Counters and gauges
+enum
+{
+	M_CYCLES,
+	M_BLUEZ_ERRORS,
+	M_ERROR_STREAK,
+	M_DEVICES_NEW,
+	M_DEVICES_REPEAT,
+	M_CACHE_ENTRIES,
+	M_CACHE_SIZE,
+	M_CACHE_RESETS,
+	M_CACHE_EVICTIONS,
+	M_NAME_OK,
+	M_NAME_FAILED,
+	M_BYTES_FILE,
+	M_BYTES_SYSLOG,
+	M_BYTES_UDP,
+	M_UDP_ERRORS,
+	M_STARTED,
+	M_SESSIONS_OPEN,
+	M_DWELL_STDDEV,
+	METRIC_COUNT
+};
+
+// Histograms
+enum
+{
+	H_CYCLE_TIME,
+	H_CYCLE_RESULTS,
+	H_NAME_TIME,
+	H_FLUSH_TIME,
+	H_DWELL_TIME,
+	HIST_COUNT
+};
+
+// Entries with the same name are one metric with different labels
+static const struct
+{
+	const char *name;
+	const char *type;
+	const char *label;
+	const char *help;
+} metric_info[METRIC_COUNT] =
+{
+	{ "bluelog_inquiry_cycles_total", "counter", NULL, "Inquiry cycles completed." },
+	{ "bluelog_bluez_errors_total", "counter", NULL, "Inquiries that BlueZ returned an error for." },
+	{ "bluelog_bluez_error_streak", "gauge", NULL, "Back to back BlueZ errors, as counted by the scan loop." },
+	{ "bluelog_devices_total", "counter", "kind=\"new\"", "Devices in inquiry results, new or already in the cache." },
+	{ "bluelog_devices_total", "counter", "kind=\"repeat\"", NULL },
+	{ "bluelog_cache_entries", "gauge", NULL, "Devices in the cache." },
+	{ "bluelog_cache_capacity", "gauge", NULL, "Devices the cache can hold before it is reset." },
+	{ "bluelog_cache_resets_total", "counter", NULL, "Times the device cache filled up and was cleared." },
+	{ "bluelog_cache_evictions_total", "counter", NULL, "Devices dropped from the cache when it was cleared." },
+	{ "bluelog_name_queries_total", "counter", "result=\"ok\"", "Remote name requests, by result." },
+	{ "bluelog_name_queries_total", "counter", "result=\"failed\"", NULL },
+	{ "bluelog_output_bytes_total", "counter", "sink=\"file\"", "Bytes of device records written, by output." },
+	{ "bluelog_output_bytes_total", "counter", "sink=\"syslog\"", NULL },
+	{ "bluelog_output_bytes_total", "counter", "sink=\"udp\"", NULL },
+	{ "bluelog_udp_send_errors_total", "counter", NULL, "UDP messages that could not be sent." },
+	{ "bluelog_start_time_seconds", "gauge", NULL, "When the scan started, seconds since the epoch." },
+	{ "bluelog_sessions_open", "gauge", NULL, "Devices seen within the absence time." },
+	{ "bluelog_session_dwell_stddev_seconds", "gauge", NULL, "Standard deviation of dwell time over closed sessions." },
+};
+
+// Bucket upper bounds, observations go in the first one they fit
+static const struct
+{
+	const char *name;
+	const char *help;
+	double bound[METRICS_BUCKETS];
+} hist_info[HIST_COUNT] =
+{
+	{ "bluelog_inquiry_duration_seconds", "Time for a whole scan cycle, including name requests and output.",
+		{ 1, 2, 3, 4, 5, 6, 8, 10, 15, 30 } },
+	{ "bluelog_inquiry_results", "Devices returned per inquiry.",
+		{ 0, 1, 2, 3, 5, 10, 20, 50, 100, 200 } },
+	{ "bluelog_name_query_duration_seconds", "Time for a remote name request, successful or not.",
+		{ 0.05, 0.1, 0.25, 0.5, 1, 2, 5, 10, 20, 40 } },
+	{ "bluelog_flush_duration_seconds", "Time to flush the output file.",
+		{ 0.00001, 0.00005, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5 } },
+	{ "bluelog_session_dwell_seconds", "Time from first to last sighting of closed sessions.",
+		{ 60, 120, 300, 600, 1200, 1800, 3600, 7200, 14400, 28800 } },
+};
+
+struct metrics_hist
+{
+	uint64_t bucket[METRICS_BUCKETS + 1];
+	uint64_t count;
+	double sum;
+};
+
+struct metrics
+{
+	uint64_t value[METRIC_COUNT];
+	struct metrics_hist hist[HIST_COUNT];
+};
+
+// This thread's metrics, only ever touched by the thread itself
+__thread struct metrics metrics_thread;
+static __thread int metrics_slot = -1;
+
+// Published copies, one per thread
+static struct metrics metrics_slots[METRICS_THREADS];
+static int metrics_used = 0;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// When the metrics file was last written
+static time_t metrics_written = 0;
+static int metrics_failed = 0;
+
+static inline void metrics_add (int metric, uint64_t amount)
+{
+	metrics_thread.value[metric] += amount;
+}
+
+static inline void metrics_set (int metric, uint64_t value)
+{
+	metrics_thread.value[metric] = value;
+}
+
+void metrics_observe (int hist, double value)
+{
+	struct metrics_hist *h = &metrics_thread.hist[hist];
+	int b = 0;
+
+	while (b < METRICS_BUCKETS && value > hist_info[hist].bound[b])
+		b++;
+	h->bucket[b]++;
+	h->count++;
+	h->sum += value;
+}
+
+// Monotonic clock in seconds, for timing
+double metrics_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// Add up every thread's slot
+static void metrics_total (struct metrics *total)
+{
+	int s, i, b;
+
+	memset(total, 0, sizeof(*total));
+	pthread_mutex_lock(&metrics_mutex);
+	for (s = 0; s < metrics_used; s++)
+	{
+		for (i = 0; i < METRIC_COUNT; i++)
+			total->value[i] += metrics_slots[s].value[i];
+		for (i = 0; i < HIST_COUNT; i++)
+		{
+			for (b = 0; b <= METRICS_BUCKETS; b++)
+				total->hist[i].bucket[b] += metrics_slots[s].hist[i].bucket[b];
+			total->hist[i].count += metrics_slots[s].hist[i].count;
+			total->hist[i].sum += metrics_slots[s].hist[i].sum;
+		}
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+// Everything in Prometheus text format
+void metrics_print (FILE *out)
+{
+	struct metrics total;
+	uint64_t cumulative;
+	int i, b;
+
+	metrics_total(&total);
+
+	for (i = 0; i < METRIC_COUNT; i++)
+	{
+		// Labelled entries share the first one's description
+		if (metric_info[i].help != NULL)
+			fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", metric_info[i].name,
+				metric_info[i].help, metric_info[i].name, metric_info[i].type);
+		if (metric_info[i].label != NULL)
+			fprintf(out, "%s{%s} %llu\n", metric_info[i].name, metric_info[i].label,
+				(unsigned long long)total.value[i]);
+		else
+			fprintf(out, "%s %llu\n", metric_info[i].name, (unsigned long long)total.value[i]);
+	}
+
+	for (i = 0; i < HIST_COUNT; i++)
+	{
+		fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", hist_info[i].name,
+			hist_info[i].help, hist_info[i].name);
+		cumulative = 0;
+		for (b = 0; b < METRICS_BUCKETS; b++)
+		{
+			cumulative += total.hist[i].bucket[b];
+			fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", hist_info[i].name,
+				hist_info[i].bound[b], (unsigned long long)cumulative);
+		}
+		fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", hist_info[i].name, (unsigned long long)total.hist[i].count);
+		fprintf(out, "%s_sum %.6f\n", hist_info[i].name, total.hist[i].sum);
+		fprintf(out, "%s_count %llu\n", hist_info[i].name, (unsigned long long)total.hist[i].count);
+	}
+}
+
+// Write to temporary file and rename over the old one, so readers
+// never see it half written
+static void metrics_write_file (const char *filename)
+{
+	char tempname[MAX_VALUE_LEN + 8];
+	FILE *out;
+
+	snprintf(tempname, sizeof(tempname), "%s.tmp", filename);
+	if ((out = fopen(tempname, "w")) != NULL)
+	{
+		metrics_print(out);
+		if (fclose(out) == 0 && rename(tempname, filename) == 0)
+		{
+			metrics_failed = 0;
+			return;
+		}
+		unlink(tempname);
+	}
+
+	// Only complain once until it works again
+	if (!metrics_failed)
+		syslog(LOG_ERR,"Unable to write metrics file %s!", filename);
+	metrics_failed = 1;
+}
+
+// Make this thread's numbers visible, scan loop calls it once per cycle.
+// Scan loop publishes first, so it always has slot 0.
+void metrics_publish (void)
+{
+	time_t now;
+
+	pthread_mutex_lock(&metrics_mutex);
+	if (metrics_slot < 0 && metrics_used < METRICS_THREADS)
+		metrics_slot = metrics_used++;
+	if (metrics_slot >= 0)
+		metrics_slots[metrics_slot] = metrics_thread;
+	pthread_mutex_unlock(&metrics_mutex);
+
+	// File doesn't need to change every cycle, and only the scan loop writes it
+	now = time(NULL);
+	if (metrics_slot == 0 && strcmp(config.metrics_file, "NULL") && now - metrics_written >= METRICS_INTERVAL)
+	{
+		metrics_written = now;
+		metrics_write_file(config.metrics_file);
+	}
+}
+
+void metrics_init (void)
+{
+	metrics_set(M_CACHE_SIZE, MAX_DEV);
+	metrics_set(M_STARTED, time(NULL));
+	metrics_publish();
+}
+
+// Leave file in place with the final numbers
+void metrics_close (void)
+{
+	metrics_written = 0;
+	metrics_publish();
+}
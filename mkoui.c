@@ -0,0 +1,49 @@
+/*
+ *  mkoui - Compile OUI text file into precompiled database for libmackerel
+ *
+ *  The precompiled database can be mapped directly into memory, so
+ *  programs using libmackerel don't need to parse the text file at startup.
+ *
+ *  Written by Tom Nardi (MS3FGX@gmail.com), released under the GPLv2.
+ *  For more information, see: www.digifail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Defines
+#define APPNAME "mkoui"
+#define VERSION "1.0"
+#define OUIFILE "oui.txt"
+
+#include "libmackerel.c"
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		printf("%s (v%s) by MS3FGX\n", APPNAME, VERSION);
+		printf("usage: %s <oui.txt> <oui.db>\n", argv[0]);
+		exit(1);
+	}
+
+	printf("Compiling %s...", argv[1]);
+	if (mac_oui_load(argv[1]))
+	{
+		printf("\n");
+		printf("Unable to read %s!\n", argv[1]);
+		exit(1);
+	}
+
+	if (mac_oui_write(argv[2]))
+	{
+		printf("\n");
+		printf("Unable to write %s!\n", argv[2]);
+		exit(1);
+	}
+
+	printf("OK\n");
+	printf("Wrote %i MA-L, %i MA-M, %i MA-S entries to %s\n",
+		oui_counts[0], oui_counts[1], oui_counts[2], argv[2]);
+	return 0;
+}
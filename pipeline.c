@@ -0,0 +1,420 @@
+/*
+ *  pipeline.c - Name requests and output on their own threads
+ *
+ *  Optional, enabled with PIPELINE (or --pipeline). The scan loop keeps
+ *  the inquiry, the device cache and formatting, and hands the slow parts
+ *  to two more threads over single producer, single consumer rings:
+ *
+ *    scan -> names    Remote name requests for new or unnamed devices
+ *    names -> scan    Replies, the event loop is woken for each one
+ *    scan -> sink     Finished records for the log file, syslog or UDP
+ *
+ *  So a device that won't answer its name request, or a slow disk, no
+ *  longer holds up the next inquiry. Bluelog Live and BlueProPro output
+ *  stay on the scan thread, since the live index has to know where each
+ *  record landed. Each stage can be pinned to a CPU with PIPELINECPUS.
+ */
+
+#include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+// Slots per ring, must be powers of two
+#define RING_NAMES 256
+#define RING_SINK 1024
+
+// Single producer, single consumer ring. Each side only writes its own
+// counter, and they sit on separate cache lines so they don't bounce.
+struct ring
+{
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long tail __attribute__((aligned(64)));
+	unsigned long size;
+	size_t item;
+	char *slots;
+};
+
+struct name_request
+{
+	int slot;
+	int retry;
+	uint32_t generation;
+	bdaddr_t bdaddr;
+};
+
+struct name_reply
+{
+	int slot;
+	int retry;
+	uint32_t generation;
+	bdaddr_t bdaddr;
+	int ok;
+	char name[248];
+};
+
+struct sink_record
+{
+	bdaddr_t bdaddr;
+	char line[500];
+};
+
+static struct ring name_ring, reply_ring, sink_ring;
+
+// Wakes each consumer thread when its ring gets something, and the
+// event loop when there are replies
+static int name_wake = -1;
+static int sink_wake = -1;
+int pipeline_reply_wake = -1;
+
+static pthread_t name_thread, sink_thread;
+
+// Name thread is running and takes requests
+int pipeline_names = 0;
+
+// Sink thread is running and owns file, syslog and UDP output
+int pipeline_sink = 0;
+static volatile int sink_stop = 0;
+static unsigned long sink_written = 0;
+static unsigned long sink_idle = 0; // Written and flushed, outputs not in use
+
+// Name requests get their own HCI socket, so they don't clash with the
+// scan thread's filter on the main one
+static int name_socket = -1;
+
+// Stage CPUs from PIPELINECPUS, -1 is unpinned
+static int pipeline_cpu[3] = { -1, -1, -1 };
+
+static int ring_init (struct ring *r, unsigned long size, size_t item)
+{
+	r->head = 0;
+	r->tail = 0;
+	r->size = size;
+	r->item = item;
+	r->slots = malloc(size * item);
+	return(r->slots == NULL);
+}
+
+// Returns non-zero if ring is full
+static int ring_push (struct ring *r, const void *item)
+{
+	unsigned long head = r->head;
+
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->size)
+		return(1);
+	memcpy(r->slots + (head & (r->size - 1)) * r->item, item, r->item);
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return(0);
+}
+
+// Returns non-zero if ring is empty
+static int ring_pop (struct ring *r, void *item)
+{
+	unsigned long tail = r->tail;
+
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+		return(1);
+	memcpy(item, r->slots + (tail & (r->size - 1)) * r->item, r->item);
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return(0);
+}
+
+static void wake (int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0)
+		syslog(LOG_ERR,"Unable to wake pipeline thread!");
+}
+
+// Sleep until woken, or timeout in ms
+static void wait_wake (int fd, int timeout)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint64_t count;
+
+	if (poll(&pfd, 1, timeout) > 0 && read(fd, &count, sizeof(count)) < 0)
+		syslog(LOG_ERR,"Unable to read pipeline wakeup!");
+}
+
+static void pin_thread (pthread_t thread, int cpu, const char *stage)
+{
+	cpu_set_t cpus;
+
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (pthread_setaffinity_np(thread, sizeof(cpus), &cpus))
+		syslog(LOG_ERR,"Unable to pin %s stage to CPU %i!", stage, cpu);
+}
+
+// Blocking remote name request, returns non-zero and "VOID" on failure
+int name_request (int sock, const bdaddr_t *addr, char *name)
+{
+	double start;
+	int ok;
+
+	// Terminate to prevent duplicating previous results
+	memset(name, 0, 248);
+
+	start = metrics_now();
+	PROBE1(name__start, addr);
+	ok = (hci_read_remote_name(sock, addr, 248, name, 0) >= 0);
+	PROBE2(name__done, addr, ok);
+	if (!ok)
+		strcpy(name, "VOID");
+	metrics_add(ok ? M_NAME_OK : M_NAME_FAILED, 1);
+	metrics_observe(H_NAME_TIME, metrics_now() - start);
+
+	return(!ok);
+}
+
+// Write finished record to syslog, UDP or the log file
+void sink_write (const bdaddr_t *bdaddr, char *line)
+{
+	if (config.syslogonly)
+	{
+		PROBE2(emit, bdaddr, PROBE_SINK_SYSLOG);
+		syslog(LOG_INFO,"%s", line);
+		metrics_add(M_BYTES_SYSLOG, strlen(line));
+	}
+	else if (config.udponly)
+	{
+		// Append newline to socket, kind of hacky
+		strcat(line, "\n");
+		PROBE2(emit, bdaddr, PROBE_SINK_UDP);
+		send_udp_msg(line);
+	}
+	else if (outfile != NULL)
+	{
+		PROBE2(emit, bdaddr, PROBE_SINK_FILE);
+		metrics_add(M_BYTES_FILE, fprintf(outfile,"%s\n", line));
+	}
+}
+
+static void* name_loop (void *arg)
+{
+	struct name_request request;
+	struct name_reply reply;
+
+	for (;;)
+	{
+		if (ring_pop(&name_ring, &request))
+		{
+			metrics_publish();
+			wait_wake(name_wake, -1);
+			continue;
+		}
+
+		reply.slot = request.slot;
+		reply.retry = request.retry;
+		reply.generation = request.generation;
+		bacpy(&reply.bdaddr, &request.bdaddr);
+		reply.ok = !name_request(name_socket, &request.bdaddr, reply.name);
+
+		// Scan loop empties this every cycle, so only wait if it's stuck
+		while (ring_push(&reply_ring, &reply))
+		{
+			pthread_testcancel();
+			usleep(10000);
+		}
+		wake(pipeline_reply_wake);
+	}
+	return(NULL);
+}
+
+static void* sink_loop (void *arg)
+{
+	struct sink_record record;
+	double start;
+	int wrote = 0;
+
+	for (;;)
+	{
+		if (!ring_pop(&sink_ring, &record))
+		{
+			sink_write(&record.bdaddr, record.line);
+			sink_written++;
+			wrote = 1;
+			continue;
+		}
+
+		// Caught up, flush once for the whole batch
+		if (wrote && outfile != NULL)
+		{
+			start = metrics_now();
+			PROBE(flush__start);
+			fflush(outfile);
+			PROBE(flush__done);
+			metrics_observe(H_FLUSH_TIME, metrics_now() - start);
+		}
+		// Done with the outputs until something else is queued
+		__atomic_store_n(&sink_idle, sink_written, __ATOMIC_RELEASE);
+		if (wrote)
+			metrics_publish();
+		wrote = 0;
+
+		if (sink_stop)
+			break;
+		wait_wake(sink_wake, -1);
+	}
+	return(NULL);
+}
+
+// Queue name request for cache slot, returns non-zero if it has to be
+// done inline instead
+int pipeline_name_push (int slot, int retry, uint32_t generation, const bdaddr_t *bdaddr)
+{
+	struct name_request request;
+
+	if (!pipeline_names)
+		return(1);
+
+	request.slot = slot;
+	request.retry = retry;
+	request.generation = generation;
+	bacpy(&request.bdaddr, bdaddr);
+	if (ring_push(&name_ring, &request))
+		return(1);
+	wake(name_wake);
+	return(0);
+}
+
+// Next finished name request, returns non-zero if there are none
+int pipeline_name_reply (struct name_reply *reply)
+{
+	if (!pipeline_names)
+		return(1);
+	return(ring_pop(&reply_ring, reply));
+}
+
+// Hand record to sink thread, waits if it has fallen that far behind
+void pipeline_sink_push (const bdaddr_t *bdaddr, const char *line)
+{
+	struct sink_record record;
+
+	bacpy(&record.bdaddr, bdaddr);
+	strcpy(record.line, line);
+	while (ring_push(&sink_ring, &record))
+	{
+		wake(sink_wake);
+		usleep(1000);
+	}
+	wake(sink_wake);
+}
+
+// Wait until sink thread has written and flushed everything queued so far,
+// after this outputs can be changed until the next push
+void pipeline_drain (void)
+{
+	if (!pipeline_sink)
+		return;
+
+	wake(sink_wake);
+	while (__atomic_load_n(&sink_idle, __ATOMIC_ACQUIRE) != sink_ring.head)
+		usleep(1000);
+}
+
+// CPUs for scan, names and sink, like "0,1,2". Returns non-zero if malformed.
+int pipeline_parse_cpus (const char *list, int *cpus)
+{
+	const char *p = list;
+	char *end;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		cpus[i] = -1;
+	if (!strcmp(list, "NULL"))
+		return(0);
+
+	for (i = 0; i < 3 && *p; i++)
+	{
+		if (*p < '0' || *p > '9')
+			return(1);
+		cpus[i] = strtol(p, &end, 10);
+		if (cpus[i] >= CPU_SETSIZE)
+			return(1);
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return(1);
+	}
+	return(*p != '\0');
+}
+
+// Start stage threads, called once the process won't fork again, non-zero if
+// the rings and eventfds can't be set up
+int pipeline_start (int device)
+{
+	int live = config.bluelive || config.bluepropro;
+	sigset_t all, old;
+
+	pipeline_parse_cpus(config.pipeline_cpus, pipeline_cpu);
+	pin_thread(pthread_self(), pipeline_cpu[0], "scan");
+
+	if ((name_wake = eventfd(0, 0)) < 0 || (sink_wake = eventfd(0, 0)) < 0 ||
+		(pipeline_reply_wake = eventfd(0, EFD_NONBLOCK)) < 0 ||
+		ring_init(&name_ring, RING_NAMES, sizeof(struct name_request)) ||
+		ring_init(&reply_ring, RING_NAMES, sizeof(struct name_reply)) ||
+		ring_init(&sink_ring, RING_SINK, sizeof(struct sink_record)))
+	{
+		syslog(LOG_ERR,"Unable to set up pipeline!");
+		return(1);
+	}
+
+	// Leave signals for the main thread
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	
+	if (config.getname)
+	{
+		if ((name_socket = hci_open_dev(device)) < 0)
+			syslog(LOG_ERR,"Unable to open second HCI socket, names stay in scan loop.");
+		else if (pthread_create(&name_thread, NULL, name_loop, NULL))
+			syslog(LOG_ERR,"Unable to start name thread, names stay in scan loop.");
+		else
+		{
+			pipeline_names = 1;
+			pin_thread(name_thread, pipeline_cpu[1], "name");
+		}
+	}
+
+	// Live index needs to know where each record went, so no sink thread
+	if (!live)
+	{
+		if (pthread_create(&sink_thread, NULL, sink_loop, NULL))
+			syslog(LOG_ERR,"Unable to start sink thread, output stays in scan loop.");
+		else
+		{
+			pipeline_sink = 1;
+			pin_thread(sink_thread, pipeline_cpu[2], "sink");
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	syslog(LOG_INFO,"Pipeline started, names %s, output %s.", pipeline_names ? "threaded" : "inline",
+		pipeline_sink ? "threaded" : "inline");
+	return(0);
+}
+
+// Finish queued output and stop threads. Pending name requests are dropped.
+void pipeline_stop (void)
+{
+	if (pipeline_sink)
+	{
+		sink_stop = 1;
+		wake(sink_wake);
+		pthread_join(sink_thread, NULL);
+		pipeline_sink = 0;
+	}
+
+	if (pipeline_names)
+	{
+		pthread_cancel(name_thread);
+		pthread_join(name_thread, NULL);
+		pipeline_names = 0;
+		close(name_socket);
+	}
+}
@@ -0,0 +1,57 @@
+/*
+ *  probes.h - Static tracepoints for the scan loop
+ *
+ *  If <sys/sdt.h> is available (systemtap-sdt-dev on Debian, systemtap-sdt-devel
+ *  on Fedora), each probe compiles to a single nop plus a note in the binary
+ *  that perf, bpftrace and SystemTap can attach to at runtime. Without it, or
+ *  when built with -DNO_PROBES, they compile to nothing.
+ *
+ *  Provider is "bluelog". Probes and their arguments:
+ *
+ *    inquiry__start                 Inquiry sent to adapter
+ *    inquiry__done    results       Inquiry returned (negative on error)
+ *    result__new      addr, slot    Result not in cache, given new slot
+ *    result__seen     addr, slot    Result already in cache at slot
+ *    name__start      addr          Remote name request sent
+ *    name__done       addr, ok      Name request returned, ok is 1 or 0
+ *    emit             addr, sink    Record written, sink is a PROBE_SINK_*
+ *    flush__start                   Output file flush started
+ *    flush__done                    Output file flush finished
+ *
+ *  Addresses are bdaddr_t pointers (6 bytes, least significant first).
+ *
+ *  For example, time spent on name requests:
+ *
+ *    bpftrace -e 'usdt:./bluelog:bluelog:name__start { @s[tid] = nsecs; }
+ *      usdt:./bluelog:bluelog:name__done /@s[tid]/ {
+ *      @ms = hist((nsecs - @s[tid]) / 1000000); delete(@s[tid]); }'
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined NO_PROBES && defined __has_include
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_PROBES 1
+#endif
+#endif
+
+// Where emit records went
+#define PROBE_SINK_FILE 0
+#define PROBE_SINK_SYSLOG 1
+#define PROBE_SINK_UDP 2
+#define PROBE_SINK_LIVE 3
+#define PROBE_SINK_BPP 4
+
+#ifdef HAVE_PROBES
+#define PROBE(name) DTRACE_PROBE(bluelog, name)
+#define PROBE1(name, a) DTRACE_PROBE1(bluelog, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(bluelog, name, a, b)
+#else
+#define PROBE(name) do { } while (0)
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#endif
+
+#endif
@@ -31,6 +31,8 @@ struct cfg
 	int showtime;
 	int obfuscate;
 	int encode;
+	int keyed;
+	int key_rotate;
 	int showclass;
 	int friendlyclass;
 	int bluepropro;
@@ -38,11 +40,15 @@ struct cfg
 	int amnesia;
 	int syslogonly;
 	int getmanufacturer;
+	int absence;
+	int sessions;
 	
 	// Advanced
 	int retry_count;
 	int scan_window;
 	int hci_device;
+	int pipeline;
+	char pipeline_cpus[MAX_VALUE_LEN];
 	
 	// Network
 	int udponly;
@@ -50,8 +56,13 @@ struct cfg
 	int prefix;
 	int banner;
 	int hangup;
+	int unixsock;
+	int http_port;
+	char http_root[MAX_VALUE_LEN];
 	char node_name[MAX_VALUE_LEN];
 	char server_ip[MAX_VALUE_LEN];
+	char encode_key[MAX_VALUE_LEN];
+	char metrics_file[MAX_VALUE_LEN];
 	
 	// System
 	int bt_socket;
@@ -59,36 +70,57 @@ struct cfg
 	char addr[19];
 };
 
-// Define global struct, set default values
-struct cfg config = 
-{
-	.verbose = 0,
-	.quiet = 0,
-	.daemon = 0,
-	.bluelive = 0,
-	.showtime = 0,
-	.obfuscate = 0,
-	.encode = 0,
-	.showclass = 0,
-	.friendlyclass = 0,
-	.bluepropro = 0,
-	.getname = 0,
-	.amnesia = -1,
-	.syslogonly = 0,
-	.getmanufacturer = 0,
-	.retry_count = 3,
-	.scan_window = 8,
-	.hci_device = 0,
-	.udponly = 0,
-	.udp_socket = -1,
-	.server_port = 1234,
-	.banner = 0,
-	.prefix = 1,
-	.hangup = 0,
-	.server_ip = "NULL",
-	.node_name = "NULL",
-	.addr = "NULL",
-};
+// Default values, also the starting point when reloading
+#define CFG_DEFAULTS \
+{ \
+	.verbose = 0, \
+	.quiet = 0, \
+	.daemon = 0, \
+	.bluelive = 0, \
+	.showtime = 0, \
+	.obfuscate = 0, \
+	.encode = 0, \
+	.keyed = 0, \
+	.key_rotate = 0, \
+	.showclass = 0, \
+	.friendlyclass = 0, \
+	.bluepropro = 0, \
+	.getname = 0, \
+	.amnesia = -1, \
+	.syslogonly = 0, \
+	.getmanufacturer = 0, \
+	.absence = 5, \
+	.sessions = 0, \
+	.retry_count = 3, \
+	.scan_window = 8, \
+	.hci_device = 0, \
+	.pipeline = 0, \
+	.pipeline_cpus = "NULL", \
+	.udponly = 0, \
+	.udp_socket = -1, \
+	.server_port = 1234, \
+	.banner = 0, \
+	.prefix = 1, \
+	.hangup = 0, \
+	.unixsock = 0, \
+	.http_port = 0, \
+	.http_root = HTTP_ROOT, \
+	.server_ip = "NULL", \
+	.node_name = "NULL", \
+	.encode_key = "NULL", \
+	.metrics_file = "NULL", \
+	.addr = "NULL", \
+}
+
+// Running config and pristine copy for reload
+struct cfg config = CFG_DEFAULTS;
+const struct cfg cfg_defaults = CFG_DEFAULTS;
+
+// Set if config came from file, only then can it be reloaded
+int cfg_from_file = 0;
+
+// What went wrong in cfg_load() or cfg_validate()
+char cfg_error[128];
 
 // Determine if config file is present
 int cfg_exists (void)
@@ -106,98 +138,280 @@ char* trim_space(char* s)
   return s;
 }
 
-// Convert yes/no to 1/0
-int eval_bool(char* value, int line)
+// Convert yes/no to 1/0, returns non-zero if it's neither
+int eval_bool(char* value, int* result)
 {
 	if (!strcasecmp(value, "YES"))
-		return 1;
+		*result = 1;
 	else if (!strcasecmp(value, "NO"))
-		return 0;
+		*result = 0;
 	else
-	{
-		printf("Invalid value in configuration file on line %i!\n", line);
-		exit(1);
-	}
+		return 1;
+	return 0;
 }
 
-// Make sure everybody plays nice
-static void cfg_check (void)
+// Make sure everybody plays nice, returns non-zero and sets cfg_error if not
+int cfg_validate (struct cfg* cfg)
 {
 	// Check for out of range values
-	if ((config.retry_count < 0) || ((config.amnesia < 0) && (config.amnesia != -1)))
+	if ((cfg->retry_count < 0) || (cfg->absence < 1) || (cfg->key_rotate < 0) || ((cfg->amnesia < 0) && (cfg->amnesia != -1)))
 	{	
-		printf("Error, arguments must be positive numbers!\n");
-		exit(1);
+		strcpy(cfg_error, "Error, arguments must be positive numbers!");
+		return 1;
+	}
+	
+	// Web server needs a real port
+	if (cfg->http_port < 0 || cfg->http_port > 65535)
+	{
+		strcpy(cfg_error, "Web server port is out of range. See README.");
+		return 1;
 	}
 	
 	// Make sure window is reasonable
-	if (config.scan_window > MAX_SCAN || config.scan_window < MIN_SCAN)
+	if (cfg->scan_window > MAX_SCAN || cfg->scan_window < MIN_SCAN)
 	{
-		printf("Scan window is out of range. See README.\n");
-		exit(1);
+		strcpy(cfg_error, "Scan window is out of range. See README.");
+		return 1;
 	}	
 	
+	// Stage CPUs are a list of numbers
+	if (strcmp(cfg->pipeline_cpus, "NULL") && strspn(cfg->pipeline_cpus, "0123456789,") != strlen(cfg->pipeline_cpus))
+	{
+		strcpy(cfg_error, "Pipeline CPUs must be a list like 0,1,2. See README.");
+		return 1;
+	}
+	
+	// Key is only checked here, bluelog_open() or reload puts it to use
+	if (strcmp(cfg->encode_key, "NULL"))
+	{
+		if (strlen(cfg->encode_key) != 32 || strspn(cfg->encode_key, "0123456789ABCDEFabcdef") != 32)
+		{
+			strcpy(cfg_error, "Encode key must be 32 hex digits. See README.");
+			return 1;
+		}
+		cfg->keyed = 1;
+	}
+	else
+		cfg->keyed = 0;
+	
 	// Override some options that don't play nice with others
 	// If retry is different from default, assume names are on.
-	if (config.retry_count != 3)
-		config.getname = 1;
+	if (cfg->retry_count != 3)
+		cfg->getname = 1;
 
 	// No verbose for daemon
-	if (config.daemon)
-		config.verbose = 0;
+	if (cfg->daemon)
+		cfg->verbose = 0;
 		
 	// No Bluelog Live when running BPP, names on, syslog off
-	if (config.bluepropro)
+	if (cfg->bluepropro)
 	{
-		config.bluelive = 0;
-		config.getname = 1;
-		config.syslogonly = 0;
+		cfg->bluelive = 0;
+		cfg->getname = 1;
+		cfg->syslogonly = 0;
 	}
 
 	// Showing raw class ID turns off friendly names
-	if (config.showclass)
-		config.friendlyclass = 0;
+	if (cfg->showclass)
+		cfg->friendlyclass = 0;
 			
 	// No timestamps for Bluelog Live, names on, syslog off
-	if (config.bluelive)
+	if (cfg->bluelive)
 	{
-		config.showtime = 0;
-		config.getname = 1;
-		config.syslogonly = 0;
+		cfg->showtime = 0;
+		cfg->getname = 1;
+		cfg->syslogonly = 0;
 	}
 	
 	// No timestamps in syslog mode, disable other modes
-	if (config.syslogonly)
+	if (cfg->syslogonly)
 	{
-		config.showtime = 0;
-		config.bluelive = 0;
-		config.bluepropro = 0;
+		cfg->showtime = 0;
+		cfg->bluelive = 0;
+		cfg->bluepropro = 0;
 	}
 	
 	// UDP disables other modes
-	if (config.udponly)
+	if (cfg->udponly)
 	{
-		config.bluelive = 0;
-		config.bluepropro = 0;
-		config.syslogonly = 0;
+		cfg->bluelive = 0;
+		cfg->bluepropro = 0;
+		cfg->syslogonly = 0;
 	}
 
 	// Encode trumps obfuscate
-	if (config.encode)
-		config.obfuscate = 0;
+	if (cfg->encode)
+		cfg->obfuscate = 0;
+	
+	return 0;
+}
+
+// Set one option by its name in the config file. Returns -1 if there
+// is no such option, 1 if the value is no good for it.
+int cfg_set (struct cfg* cfg, const char* token, char* value)
+{
+	int bad = 0;
+	
+	if (strlen(value) >= MAX_VALUE_LEN)
+		return(1);
+	
+	if (strcmp(token, "VERBOSE") == 0)
+		bad = eval_bool(value, &cfg->verbose);
+	else if (strcmp(token, "QUIET") == 0)
+		bad = eval_bool(value, &cfg->quiet);
+	else if (strcmp(token, "DAEMON") == 0)
+		bad = eval_bool(value, &cfg->daemon);
+	else if (strcmp(token, "LIVEMODE") == 0)
+		bad = eval_bool(value, &cfg->bluelive);
+	else if (strcmp(token, "SHOWTIME") == 0)
+		bad = eval_bool(value, &cfg->showtime);		
+	else if (strcmp(token, "OBFUSCATE") == 0)
+		bad = eval_bool(value, &cfg->obfuscate);
+	else if (strcmp(token, "ENCODE") == 0)
+		bad = eval_bool(value, &cfg->encode);
+	else if (strcmp(token, "ENCODEKEY") == 0)
+		strcpy(cfg->encode_key, value);
+	else if (strcmp(token, "KEYROTATE") == 0)
+		cfg->key_rotate = (atoi(value));
+	else if (strcmp(token, "SHOWCLASS") == 0)
+		bad = eval_bool(value, &cfg->showclass);
+	else if (strcmp(token, "FRIENDLYCLASS") == 0)
+		bad = eval_bool(value, &cfg->friendlyclass);
+	else if (strcmp(token, "BLUEPROPRO") == 0)
+		bad = eval_bool(value, &cfg->bluepropro);
+	else if (strcmp(token, "GETNAME") == 0)
+		bad = eval_bool(value, &cfg->getname);
+	else if (strcmp(token, "AMNESIA") == 0)
+		cfg->amnesia = (atoi(value));
+	else if (strcmp(token, "SYSLOGONLY") == 0)
+		bad = eval_bool(value, &cfg->syslogonly);
+	else if (strcmp(token, "ABSENCE") == 0)
+		cfg->absence = (atoi(value));
+	else if (strcmp(token, "SESSIONS") == 0)
+		bad = eval_bool(value, &cfg->sessions);
+	else if (strcmp(token, "GETMANUFACTURER") == 0)
+		bad = eval_bool(value, &cfg->getmanufacturer);			
+	else if (strcmp(token, "SCANWINDOW") == 0)
+		cfg->scan_window = (atoi(value));
+	else if (strcmp(token, "RETRYCOUNT") == 0)
+		cfg->retry_count = (atoi(value));
+	else if (strcmp(token, "HCIDEVICE") == 0)
+		cfg->hci_device = (atoi(value));
+	else if (strcmp(token, "PIPELINE") == 0)
+		bad = eval_bool(value, &cfg->pipeline);
+	else if (strcmp(token, "PIPELINECPUS") == 0)
+		strcpy(cfg->pipeline_cpus, value);
+	else if (strcmp(token, "UDPONLY") == 0)
+		bad = eval_bool(value, &cfg->udponly);
+	else if (strcmp(token, "SERVERIP") == 0)
+		strcpy(cfg->server_ip, value);
+	else if (strcmp(token, "SERVERPORT") == 0)
+		cfg->server_port = (atoi(value));					
+	else if (strcmp(token, "NODENAME") == 0)
+		strcpy(cfg->node_name, value);
+	else if (strcmp(token, "BANNER") == 0)
+		bad = eval_bool(value, &cfg->banner);
+	else if (strcmp(token, "HANGUP") == 0)
+		bad = eval_bool(value, &cfg->hangup);
+	else if (strcmp(token, "PREFIX") == 0)
+		bad = eval_bool(value, &cfg->prefix);
+	else if (strcmp(token, "UNIXSOCKET") == 0)
+		bad = eval_bool(value, &cfg->unixsock);
+	else if (strcmp(token, "HTTPPORT") == 0)
+		cfg->http_port = (atoi(value));
+	else if (strcmp(token, "HTTPROOT") == 0)
+		strcpy(cfg->http_root, value);
+	else if (strcmp(token, "METRICSFILE") == 0)
+		strcpy(cfg->metrics_file, value);
+	else
+		return(-1);
+	
+	return(bad);
 }
 
-int cfg_read (void)
+// Current value of a yes/no or number option, returns non-zero if there
+// is no such option
+int cfg_get (const struct cfg* cfg, const char* token, int* value)
+{
+	if (strcmp(token, "VERBOSE") == 0)
+		*value = cfg->verbose;
+	else if (strcmp(token, "QUIET") == 0)
+		*value = cfg->quiet;
+	else if (strcmp(token, "DAEMON") == 0)
+		*value = cfg->daemon;
+	else if (strcmp(token, "LIVEMODE") == 0)
+		*value = cfg->bluelive;
+	else if (strcmp(token, "SHOWTIME") == 0)
+		*value = cfg->showtime;
+	else if (strcmp(token, "OBFUSCATE") == 0)
+		*value = cfg->obfuscate;
+	else if (strcmp(token, "ENCODE") == 0)
+		*value = cfg->encode;
+	else if (strcmp(token, "KEYROTATE") == 0)
+		*value = cfg->key_rotate;
+	else if (strcmp(token, "SHOWCLASS") == 0)
+		*value = cfg->showclass;
+	else if (strcmp(token, "FRIENDLYCLASS") == 0)
+		*value = cfg->friendlyclass;
+	else if (strcmp(token, "BLUEPROPRO") == 0)
+		*value = cfg->bluepropro;
+	else if (strcmp(token, "GETNAME") == 0)
+		*value = cfg->getname;
+	else if (strcmp(token, "AMNESIA") == 0)
+		*value = cfg->amnesia;
+	else if (strcmp(token, "SYSLOGONLY") == 0)
+		*value = cfg->syslogonly;
+	else if (strcmp(token, "ABSENCE") == 0)
+		*value = cfg->absence;
+	else if (strcmp(token, "SESSIONS") == 0)
+		*value = cfg->sessions;
+	else if (strcmp(token, "GETMANUFACTURER") == 0)
+		*value = cfg->getmanufacturer;
+	else if (strcmp(token, "SCANWINDOW") == 0)
+		*value = cfg->scan_window;
+	else if (strcmp(token, "RETRYCOUNT") == 0)
+		*value = cfg->retry_count;
+	else if (strcmp(token, "HCIDEVICE") == 0)
+		*value = cfg->hci_device;
+	else if (strcmp(token, "PIPELINE") == 0)
+		*value = cfg->pipeline;
+	else if (strcmp(token, "UDPONLY") == 0)
+		*value = cfg->udponly;
+	else if (strcmp(token, "SERVERPORT") == 0)
+		*value = cfg->server_port;
+	else if (strcmp(token, "BANNER") == 0)
+		*value = cfg->banner;
+	else if (strcmp(token, "HANGUP") == 0)
+		*value = cfg->hangup;
+	else if (strcmp(token, "PREFIX") == 0)
+		*value = cfg->prefix;
+	else if (strcmp(token, "UNIXSOCKET") == 0)
+		*value = cfg->unixsock;
+	else if (strcmp(token, "HTTPPORT") == 0)
+		*value = cfg->http_port;
+	else
+		return(1);
+	
+	return(0);
+}
+
+// Read config file into cfg, returns 1 if it can't be opened and -1 with
+// cfg_error set if something in it is wrong
+int cfg_load (struct cfg* cfg)
 {
 	FILE* cfgfile;
 	char line[MAX_LINE_LEN + 1];
 	char* token;
 	char* value;
 	int linenum = 1;
+	int bad;
         
 	// Open file, return error if something goes wrong
 	if ((cfgfile = fopen(CFG_FILE, "r")) == NULL)
+	{
+		strcpy(cfg_error, "Error opening config file!");
 		return(1);
+	}
 		
 	// Continue until file is done
 	while(fgets(line, MAX_LINE_LEN, cfgfile) != NULL)
@@ -206,84 +420,45 @@ int cfg_read (void)
 		if(token != NULL && token[0] != '#')
 		{			
 			// Get token's associated value
-			value = trim_space(strtok(NULL, "\t;=\n\r"));
+			if ((value = strtok(NULL, "\t;=\n\r")) != NULL)
+				value = trim_space(value);
 								
 			if (value != NULL)
 			{
 				// Is it too large?
-				if ((sizeof (value)) > MAX_VALUE_LEN)
+				if (strlen(value) >= MAX_VALUE_LEN)
 				{
-					printf("FAILED\n");
-					printf("Value too large on line %i!\n", linenum);
-					exit(1);
+					snprintf(cfg_error, sizeof(cfg_error), "Value too large on line %i!", linenum);
+					fclose(cfgfile);
+					return(-1);
 				}
 				
 				// See if token matches something
-				if (strcmp(token, "VERBOSE") == 0)
-					config.verbose = eval_bool(value, linenum);
-				else if (strcmp(token, "QUIET") == 0)
-					config.quiet = eval_bool(value, linenum);
-				else if (strcmp(token, "DAEMON") == 0)
-					config.daemon = eval_bool(value, linenum);
-				else if (strcmp(token, "LIVEMODE") == 0)
-					config.bluelive = eval_bool(value, linenum);
-				else if (strcmp(token, "SHOWTIME") == 0)
-					config.showtime = eval_bool(value, linenum);		
-				else if (strcmp(token, "OBFUSCATE") == 0)
-					config.obfuscate = eval_bool(value, linenum);
-				else if (strcmp(token, "ENCODE") == 0)
-					config.encode = eval_bool(value, linenum);				
-				else if (strcmp(token, "SHOWCLASS") == 0)
-					config.showclass = eval_bool(value, linenum);
-				else if (strcmp(token, "FRIENDLYCLASS") == 0)
-					config.friendlyclass = eval_bool(value, linenum);
-				else if (strcmp(token, "BLUEPROPRO") == 0)
-					config.bluepropro = eval_bool(value, linenum);
-				else if (strcmp(token, "GETNAME") == 0)
-					config.getname = eval_bool(value, linenum);
-				else if (strcmp(token, "AMNESIA") == 0)
-					config.amnesia = (atoi(value));
-				else if (strcmp(token, "SYSLOGONLY") == 0)
-					config.syslogonly = eval_bool(value, linenum);
-				else if (strcmp(token, "GETMANUFACTURER") == 0)
-					config.getmanufacturer = eval_bool(value, linenum);			
-				else if (strcmp(token, "SCANWINDOW") == 0)
-					config.scan_window = (atoi(value));
-				else if (strcmp(token, "RETRYCOUNT") == 0)
-					config.retry_count = (atoi(value));
-				else if (strcmp(token, "HCIDEVICE") == 0)
-					config.hci_device = (atoi(value));
-				else if (strcmp(token, "UDPONLY") == 0)
-					config.udponly = eval_bool(value, linenum);
-				else if (strcmp(token, "SERVERIP") == 0)
-					strcpy(config.server_ip, value);
-				else if (strcmp(token, "SERVERPORT") == 0)
-					config.server_port = (atoi(value));					
-				else if (strcmp(token, "NODENAME") == 0)
-					strcpy(config.node_name, value);
-				else if (strcmp(token, "BANNER") == 0)
-					config.banner = eval_bool(value, linenum);
-				else if (strcmp(token, "HANGUP") == 0)
-					config.hangup = eval_bool(value, linenum);
-				else if (strcmp(token, "PREFIX") == 0)
-					config.prefix = eval_bool(value, linenum);
-				else
+				if ((bad = cfg_set(cfg, token, value)) < 0)
+				{
+					snprintf(cfg_error, sizeof(cfg_error), "Syntax error or unknown option in configuration file on line %i!", linenum);
+					fclose(cfgfile);
+					return(-1);
+				}
+				
+				if (bad)
 				{
-					printf("FAILED\n");
-					printf("Syntax error or unknown option in configuration file on line %i!\n", linenum);
-					exit(1);
+					snprintf(cfg_error, sizeof(cfg_error), "Invalid value in configuration file on line %i!", linenum);
+					fclose(cfgfile);
+					return(-1);
 				}
 			}
 			else
 			{
-				printf("FAILED\n");
-				printf("Value missing in configuration file on line %i!\n", linenum);
-				exit(1);
+				snprintf(cfg_error, sizeof(cfg_error), "Value missing in configuration file on line %i!", linenum);
+				fclose(cfgfile);
+				return(-1);
 			}
 		}
 	// Increment line number
 	linenum++;
 	}
 
+	fclose(cfgfile);
 	return (0);
 }
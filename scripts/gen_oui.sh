@@ -1,10 +1,14 @@
 #!/bin/bash
 # Generate OUI list for libmackerel
-VER="1.4"
+VER="1.5"
 
 # File to download
 DLFILE="http://linuxnet.ca/ieee/oui.txt.gz"
 
+# MA-M (28-bit) and MA-S (36-bit) assignments
+MAMFILE="http://standards-oui.ieee.org/oui28/mam.txt"
+MASFILE="http://standards-oui.ieee.org/oui36/oui36.txt"
+
 # Location of tmp file
 TMPDIR="/tmp"
 TMPFILE="/tmp/out.tmp"
@@ -31,6 +35,16 @@ wget --quiet -P $TMPDIR $DLFILE || \
 	ErrorMsg ERR "Unable to contact server!"
 
 echo "OK"
+
+# Smaller blocks are nice to have, but not required
+echo -n "Downloading MA-M and MA-S files..."
+if wget --quiet -O $TMPDIR/mam.txt $MAMFILE && \
+	wget --quiet -O $TMPDIR/oui36.txt $MASFILE; then
+	echo "OK"
+else
+	rm -f $TMPDIR/mam.txt $TMPDIR/oui36.txt
+	echo "SKIPPED"
+fi
 }
 
 expand_file ()
@@ -57,9 +71,26 @@ sed -i 's/-/:/g' $OUIFILE || \
 sed -i 's/,//g2' $OUIFILE || \
 	ErrorMsg ERR "Unable to format manufacturers!"
 
+# Append MA-M and MA-S blocks, which add 1 or 3 hex digits to the OUI
+# taken from the start of the "(base 16)" range
+format_block $TMPDIR/mam.txt 1
+format_block $TMPDIR/oui36.txt 3
+
 echo "OK"
 }
 
+format_block ()
+{
+[ -f $1 ] || return 0
+tr -d '\r' < $1 | awk -v n=$2 '
+	/\(hex\)/ { oui=$1; $1=$2=""; name=$0; next }
+	/\(base 16\)/ { gsub(/,/, "", name); sub(/^ */, "", name);
+		print oui"-"substr($1,1,n)","name }' | \
+	sed 's/-/:/g; s/ *$//' >> $OUIFILE || \
+	ErrorMsg ERR "Unable to format $1!"
+rm -f $1
+}
+
 clean_all ()
 {
 echo -n "Removing files..."
@@ -0,0 +1,151 @@
+/*
+ *  sessions.c - Presence sessions and dwell time
+ *
+ *  A device's session opens when it is first seen and closes once it has
+ *  gone unseen for ABSENCE minutes, seeing it after that opens a new one.
+ *  Dwell is the time from the first sighting in a session to the last.
+ *
+ *  Each closed session goes into running dwell statistics, for all devices
+ *  and for the device itself, using Welford's method so a sighting or a
+ *  close is constant time and nothing has to be kept per session. With
+ *  SESSIONS (or --sessions) each closed session is also written to the log,
+ *  syslog or UDP as:
+ *
+ *    SESSION,MAC,start,end,dwell,sightings,sessions,mean dwell[,name]
+ *
+ *  Where sightings are the inquiries it showed up in this session, and
+ *  sessions and mean dwell are for this device so far. Live and BlueProPro
+ *  logs have fixed formats, so sessions aren't written to them.
+ *
+ *  Sessions still open when the device cache is reset or Bluelog shuts
+ *  down are closed right then.
+ */
+
+// Dwell of every closed session so far
+struct dwell_stats
+{
+	uint64_t count;
+	double mean;
+	double m2;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct dwell_stats dwell_all;
+
+// Sessions that haven't closed yet
+int sessions_open = 0;
+
+// Welford's update for mean and sum of squared differences, n counts x
+static void dwell_update (double *mean, double *m2, uint64_t n, double x)
+{
+	double delta = x - *mean;
+
+	*mean += delta / n;
+	*m2 += delta * (x - *mean);
+}
+
+static double dwell_stddev (double m2, uint64_t n)
+{
+	return((n > 1) ? sqrt(m2 / (n - 1)) : 0);
+}
+
+// Device was seen, opens a new session if the last one has closed
+void session_seen (struct btdev *dev, uint64_t now)
+{
+	if (dev->sightings && !dev->gone)
+	{
+		dev->sightings++;
+		return;
+	}
+
+	dev->gone = 0;
+	dev->session_start = now;
+	dev->sightings = 1;
+	sessions_open++;
+	metrics_set(M_SESSIONS_OPEN, sessions_open);
+}
+
+// Write closed session to whatever outputs take it
+static void session_write (struct btdev *dev, uint64_t dwell)
+{
+	char outbuffer[500];
+	char start[20], end[20];
+	time_t stamp;
+
+	if (!config.sessions || config.bluelive || config.bluepropro || instance->failed)
+		return;
+
+	stamp = dev->session_start;
+	strftime(start, sizeof(start), "%D %T", localtime(&stamp));
+	stamp = dev->last_seen;
+	strftime(end, sizeof(end), "%D %T", localtime(&stamp));
+
+	snprintf(outbuffer, sizeof(outbuffer), "SESSION,%s,%s,%s,%llu,%u,%u,%.0f", dev->addr, start, end,
+		(unsigned long long)dwell, dev->sightings, dev->sessions, dev->dwell_mean);
+	if (config.getname)
+		snprintf(outbuffer + strlen(outbuffer), sizeof(outbuffer) - strlen(outbuffer), ",%s", dev->name);
+
+	if (pipeline_sink)
+		pipeline_sink_push(&dev->bdaddr, outbuffer);
+	else
+		sink_write(&dev->bdaddr, outbuffer);
+}
+
+// Device has been gone for the absence time, or is being dropped
+void session_close (struct btdev *dev)
+{
+	uint64_t dwell = dev->last_seen - dev->session_start;
+
+	dev->gone = 1;
+	sessions_open--;
+
+	dwell_all.count++;
+	dwell_update(&dwell_all.mean, &dwell_all.m2, dwell_all.count, dwell);
+	if (dwell_all.count == 1 || dwell < dwell_all.min)
+		dwell_all.min = dwell;
+	if (dwell > dwell_all.max)
+		dwell_all.max = dwell;
+
+	dev->sessions++;
+	dwell_update(&dev->dwell_mean, &dev->dwell_m2, dev->sessions, dwell);
+
+	metrics_set(M_SESSIONS_OPEN, sessions_open);
+	metrics_set(M_DWELL_STDDEV, llround(dwell_stddev(dwell_all.m2, dwell_all.count)));
+	metrics_observe(H_DWELL_TIME, dwell);
+
+	session_write(dev, dwell);
+	notify(EV_GONE, dev);
+	notify(EV_SESSION, dev);
+}
+
+// Close sessions of devices unseen for the absence time
+void sessions_expire (uint64_t now)
+{
+	int ri;
+
+	for (ri = 0; ri < cache_index; ri++)
+		if (!dev_cache[ri].gone && (now - dev_cache[ri].last_seen) >= (config.absence * 60))
+			session_close(&dev_cache[ri]);
+}
+
+// Close everything still open, before the cache goes away
+void sessions_close_all (void)
+{
+	int ri;
+
+	for (ri = 0; ri < cache_index; ri++)
+		if (!dev_cache[ri].gone)
+			session_close(&dev_cache[ri]);
+}
+
+// Totals for syslog at shutdown
+void sessions_summary (void)
+{
+	if (dwell_all.count == 0)
+		return;
+
+	syslog(LOG_INFO,"Sessions: %llu, dwell mean %.0fs, stddev %.0fs, min %llus, max %llus",
+		(unsigned long long)dwell_all.count, dwell_all.mean, dwell_stddev(dwell_all.m2, dwell_all.count),
+		(unsigned long long)dwell_all.min, (unsigned long long)dwell_all.max);
+}
@@ -11,30 +11,51 @@
 // Global UDP struct
 struct sockaddr_in adr_srvr; 	
 
-// Make sure network config is valid, otherwise, bail out.
-static void net_cfg_check (void)
+// Point UDP output at server in config, at startup and on reload. Returns
+// non-zero with cfg_error set, and leaves the running target alone, if
+// there's a problem.
+int udp_reload (struct cfg* new_cfg)
 {
-	// Bro, do you even config?
-	if (!strcmp (config.server_ip, "NULL"))
+	struct sockaddr_in target;
+	
+	if (!strcmp(new_cfg->server_ip, "NULL"))
 	{
-		printf("No server IP configured! See README.NET\n");
-		exit(1);
+		strcpy(cfg_error, "No server IP configured! See README.NET");
+		return 1;
 	}
 	
-	// If no node name has been configured, use hostname
-	if (!strcmp (config.node_name, "NULL"))
+	memset(&target,0,sizeof target);
+	target.sin_family = AF_INET;
+	target.sin_port = htons(new_cfg->server_port);
+	target.sin_addr.s_addr = inet_addr(new_cfg->server_ip);
+	if (target.sin_addr.s_addr == INADDR_NONE)
 	{
-		// Get hostname
-		char hostname[64];
-		hostname[63] = '\0';
-		gethostname(hostname, 63);
-		strcpy(config.node_name, hostname);
+		strcpy(cfg_error, "Invalid IP Address!");
+		return 1;
 	}
+	
+	// Socket isn't tied to a server, so keep the one we have
+	if (new_cfg->udp_socket < 0 && (new_cfg->udp_socket = socket(AF_INET,SOCK_DGRAM, 0)) == -1)
+	{
+		strcpy(cfg_error, "Error opening socket!");
+		return 1;
+	}
+	
+	if (!strcmp(new_cfg->node_name, "NULL"))
+	{
+		new_cfg->node_name[MAX_VALUE_LEN - 1] = '\0';
+		gethostname(new_cfg->node_name, MAX_VALUE_LEN - 1);
+	}
+	
+	adr_srvr = target;
+	return 0;
 }
 
 // Send string over UDP socket
 int send_udp_msg (char* msg_string)
 {  				
+	ssize_t sent;
+	
 	if (config.prefix)
 	{
 		// Send node name first, no newline
@@ -42,43 +63,27 @@ int send_udp_msg (char* msg_string)
 		sendto(config.udp_socket, ": ", strlen(": "), 0, (struct sockaddr *)&adr_srvr, (sizeof adr_srvr));
 	}
 	
-	if ((sendto(config.udp_socket, msg_string, strlen(msg_string), 0, (struct sockaddr *)&adr_srvr, (sizeof adr_srvr))) < 0)
+	if ((sent = sendto(config.udp_socket, msg_string, strlen(msg_string), 0, (struct sockaddr *)&adr_srvr, (sizeof adr_srvr))) < 0)
 	{
-		printf("Failed to send UDP message!\n");
-		exit(1);
+		// Count it and carry on, server may just be down for a bit
+		metrics_add(M_UDP_ERRORS, 1);
+		return -1;
 	}
 	
+	metrics_add(M_BYTES_UDP, sent);
 	return 0;
 }
 
-// Open a UDP socket to configured IP/port
+// Open a UDP socket to configured IP/port, non-zero with cfg_error set
+// if the config is bad or there's no socket
 int open_udp_socket (void)
 {
-	// Verify config
-	net_cfg_check();
-	
-	// Setup socket
-	memset(&adr_srvr,0,sizeof adr_srvr);
-	adr_srvr.sin_family = AF_INET;
-	adr_srvr.sin_port = htons(config.server_port);
-	adr_srvr.sin_addr.s_addr =  inet_addr(config.server_ip);
-
 	if (!config.quiet)
 		printf("Opening UDP socket to %s:%i...", config.server_ip, config.server_port);
 	
-	// Valid IP?
-	if (adr_srvr.sin_addr.s_addr == INADDR_NONE)
-	{
-		printf("Invalid IP Address!\n");
-		exit(1);
-	}
-
-	// Create a UDP socket to use
-	if ((config.udp_socket = socket(AF_INET,SOCK_DGRAM, 0)) == -1)
-	{
-		printf("Error opening socket!\n");
-		exit(1);
-	}
+	// Same checks as a reload
+	if (udp_reload(&config))
+		return 1;
 
 	// Announce we've connected
 	if (config.banner)
@@ -0,0 +1,374 @@
+/*
+ *  unixsock.c - Stream device records to local subscribers over a
+ *  Unix domain socket.
+ *
+ *  Clients connect to SOCK_FILE and receive one line per event:
+ *
+ *    EVENT,time,MAC,name,0xCLASS
+ *
+ *  Where EVENT is NEW, SEEN, or GONE. Clients that ask for SESSION get
+ *  one more when a device leaves, with when its session started (epoch),
+ *  dwell in seconds, and inquiries it was seen in:
+ *
+ *    SESSION,time,MAC,name,0xCLASS,start,dwell,sightings
+ *
+ *  Clients can narrow the stream by writing filter commands to the socket,
+ *  one per line:
+ *
+ *    EVENTS new,seen,gone    Only send these events (default is all but
+ *                            session)
+ *    PREFIX 00:11:22         Only send MACs starting with prefix
+ *    CLASS 2                 Only send devices of given major class
+ *    NAME phone              Only send names containing string
+ *
+ *  Sending a command with no argument clears that filter. A client can
+ *  also send METRICS, which gets the current metrics in Prometheus text
+ *  format, ending with "# EOF". Each client
+ *  gets its own ring buffer, if a client can't keep up and the buffer
+ *  fills, it gets dropped rather than holding up the scan.
+ */
+
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+// Size limits
+#define SOCK_MAX_CLIENTS 16
+#define SOCK_RING_SIZE 16384
+#define SOCK_CMD_LEN 128
+
+// Event types, can be ORed together for filters
+#define EV_NEW 0x1
+#define EV_SEEN 0x2
+#define EV_GONE 0x4
+#define EV_SESSION 0x8
+#define EV_ALL (EV_NEW | EV_SEEN | EV_GONE)
+
+// Connected subscriber
+struct sock_client
+{
+	int fd;
+
+	// Filters
+	int events;
+	int major;
+	char prefix[18];
+	char name[64];
+
+	// Partial command from client
+	char cmd[SOCK_CMD_LEN];
+	int cmd_len;
+
+	// Outgoing ring buffer, head and tail only ever increase
+	char ring[SOCK_RING_SIZE];
+	unsigned long head;
+	unsigned long tail;
+};
+
+// Global socket state
+int sock_listen = -1;
+int sock_loop = -1; // Event loop to add clients to
+struct sock_client *sock_clients[SOCK_MAX_CLIENTS];
+
+// Drop client and free its slot
+static void sock_drop (int slot)
+{
+	close(sock_clients[slot]->fd);
+	free(sock_clients[slot]);
+	sock_clients[slot] = NULL;
+}
+
+// Send as much of the ring as the client will take without blocking
+static int sock_flush (struct sock_client *client)
+{
+	ssize_t sent;
+	unsigned long pos, len;
+
+	while (client->tail != client->head)
+	{
+		// Send up to the end of the ring, wrap on next pass
+		pos = client->tail % SOCK_RING_SIZE;
+		len = client->head - client->tail;
+		if (len > SOCK_RING_SIZE - pos)
+			len = SOCK_RING_SIZE - pos;
+
+		sent = send(client->fd, client->ring + pos, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0)
+		{
+			// Not ready, try again later
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 0;
+			return 1;
+		}
+		client->tail += sent;
+	}
+	return 0;
+}
+
+// Copy into client's ring, returns non-zero if there isn't room
+static int sock_queue (struct sock_client *client, const char *data, unsigned long len)
+{
+	unsigned long pos, first;
+
+	if (len > SOCK_RING_SIZE - (client->head - client->tail))
+		return 1;
+
+	// Wrap as needed
+	pos = client->head % SOCK_RING_SIZE;
+	first = (len < SOCK_RING_SIZE - pos) ? len : SOCK_RING_SIZE - pos;
+	memcpy(client->ring + pos, data, first);
+	memcpy(client->ring, data + first, len - first);
+	client->head += len;
+	return 0;
+}
+
+// Queue metrics for client, skipped if it's too far behind to take them
+static void sock_metrics (struct sock_client *client)
+{
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out;
+
+	if ((out = open_memstream(&text, &len)) == NULL)
+		return;
+	metrics_print(out);
+	fputs("# EOF\n", out);
+	fclose(out);
+	sock_queue(client, text, len);
+	free(text);
+}
+
+// Apply a single command from client
+static void sock_command (struct sock_client *client, char *cmd)
+{
+	char *arg;
+
+	// Split command and argument
+	arg = strchr(cmd, ' ');
+	if (arg != NULL)
+		*arg++ = '\0';
+	else
+		arg = "";
+
+	if (!strcasecmp(cmd, "EVENTS"))
+	{
+		if (*arg == '\0')
+		{
+			client->events = EV_ALL;
+			return;
+		}
+		client->events = 0;
+		if (strcasestr(arg, "new"))
+			client->events |= EV_NEW;
+		if (strcasestr(arg, "seen"))
+			client->events |= EV_SEEN;
+		if (strcasestr(arg, "gone"))
+			client->events |= EV_GONE;
+		if (strcasestr(arg, "session"))
+			client->events |= EV_SESSION;
+	}
+	else if (!strcasecmp(cmd, "PREFIX"))
+	{
+		strncpy(client->prefix, arg, sizeof(client->prefix) - 1);
+		client->prefix[sizeof(client->prefix) - 1] = '\0';
+	}
+	else if (!strcasecmp(cmd, "CLASS"))
+		client->major = (*arg == '\0') ? -1 : atoi(arg);
+	else if (!strcasecmp(cmd, "NAME"))
+	{
+		strncpy(client->name, arg, sizeof(client->name) - 1);
+		client->name[sizeof(client->name) - 1] = '\0';
+	}
+	else if (!strcasecmp(cmd, "METRICS"))
+		sock_metrics(client);
+}
+
+// Read pending commands from client, returns non-zero on hangup
+static int sock_read (struct sock_client *client)
+{
+	char buffer[SOCK_CMD_LEN];
+	ssize_t len;
+	int i;
+
+	for (;;)
+	{
+		len = recv(client->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (len == 0)
+			return 1;
+		if (len < 0)
+			return !(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+		for (i = 0; i < len; i++)
+		{
+			if (buffer[i] == '\n' || buffer[i] == '\r')
+			{
+				client->cmd[client->cmd_len] = '\0';
+				if (client->cmd_len > 0)
+					sock_command(client, client->cmd);
+				client->cmd_len = 0;
+			}
+			else if (client->cmd_len < SOCK_CMD_LEN - 1)
+				client->cmd[client->cmd_len++] = buffer[i];
+		}
+	}
+}
+
+// Accept new clients, read their commands, and push out buffered data
+void sock_service (void)
+{
+	int i, fd;
+
+	if (sock_listen < 0)
+		return;
+
+	// Take everyone who is waiting
+	while ((fd = accept(sock_listen, NULL, NULL)) >= 0)
+	{
+		for (i = 0; i < SOCK_MAX_CLIENTS; i++)
+			if (sock_clients[i] == NULL)
+				break;
+
+		if (i == SOCK_MAX_CLIENTS || (sock_clients[i] = calloc(1, sizeof(struct sock_client))) == NULL)
+		{
+			syslog(LOG_INFO, "Subscriber limit reached, refusing connection.");
+			close(fd);
+			continue;
+		}
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		if (sock_loop >= 0)
+		{
+			struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+			epoll_ctl(sock_loop, EPOLL_CTL_ADD, fd, &event);
+		}
+		sock_clients[i]->fd = fd;
+		sock_clients[i]->events = EV_ALL;
+		sock_clients[i]->major = -1;
+	}
+
+	// Handle existing clients
+	for (i = 0; i < SOCK_MAX_CLIENTS; i++)
+	{
+		if (sock_clients[i] == NULL)
+			continue;
+
+		if (sock_read(sock_clients[i]) || sock_flush(sock_clients[i]))
+			sock_drop(i);
+	}
+}
+
+// Queue event for every client whose filters match
+void sock_event (int event, struct btdev *dev)
+{
+	char record[400];
+	int i, len;
+	struct sock_client *client;
+
+	if (sock_listen < 0)
+		return;
+
+	len = -1;
+	for (i = 0; i < SOCK_MAX_CLIENTS; i++)
+	{
+		client = sock_clients[i];
+		if (client == NULL)
+			continue;
+
+		// Check filters
+		if (!(client->events & event))
+			continue;
+		if (client->major >= 0 && client->major != (dev->major_class & 0x1f))
+			continue;
+		if (client->prefix[0] && strncasecmp(dev->addr, client->prefix, strlen(client->prefix)))
+			continue;
+		if (client->name[0] && !strcasestr(dev->name, client->name))
+			continue;
+
+		// Only format the record once somebody wants it
+		if (len < 0 && event == EV_SESSION)
+		{
+			len = snprintf(record, sizeof(record), "SESSION,%s,%s,%s,0x%02x%02x%02x,%llu,%llu,%u\n",
+				dev->time, dev->addr, dev->name,
+				dev->flags, dev->major_class, dev->minor_class,
+				(unsigned long long)dev->session_start,
+				(unsigned long long)(dev->last_seen - dev->session_start), dev->sightings);
+			if (len >= sizeof(record))
+				len = sizeof(record) - 1;
+		}
+		else if (len < 0)
+		{
+			len = snprintf(record, sizeof(record), "%s,%s,%s,%s,0x%02x%02x%02x\n",
+				(event == EV_NEW) ? "NEW" : (event == EV_SEEN) ? "SEEN" : "GONE",
+				dev->time, dev->addr, dev->name,
+				dev->flags, dev->major_class, dev->minor_class);
+			if (len >= sizeof(record))
+				len = sizeof(record) - 1;
+		}
+
+		// Drop client if it has fallen too far behind
+		if (sock_queue(client, record, len))
+		{
+			syslog(LOG_INFO, "Dropping slow subscriber.");
+			sock_drop(i);
+			continue;
+		}
+
+		if (sock_flush(client))
+			sock_drop(i);
+	}
+}
+
+// Close all clients and remove socket
+void close_unix_socket (void)
+{
+	int i;
+
+	if (sock_listen < 0)
+		return;
+
+	for (i = 0; i < SOCK_MAX_CLIENTS; i++)
+		if (sock_clients[i] != NULL)
+			sock_drop(i);
+
+	close(sock_listen);
+	sock_listen = -1;
+	unlink(SOCK_FILE);
+}
+
+// Create listening socket at SOCK_FILE, non-zero with cfg_error set if it fails
+int open_unix_socket (void)
+{
+	struct sockaddr_un adr_sock;
+
+	if (!config.quiet)
+		printf("Opening subscriber socket: %s...", SOCK_FILE);
+
+	memset(&adr_sock, 0, sizeof(adr_sock));
+	adr_sock.sun_family = AF_UNIX;
+	strncpy(adr_sock.sun_path, SOCK_FILE, sizeof(adr_sock.sun_path) - 1);
+
+	if ((sock_listen = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		strcpy(cfg_error, "Error opening socket!");
+		return 1;
+	}
+
+	// Clean up after a previous run, PID check means nobody else owns it
+	unlink(SOCK_FILE);
+
+	if (bind(sock_listen, (struct sockaddr *)&adr_sock, sizeof(adr_sock)) < 0 || listen(sock_listen, 8) < 0)
+	{
+		snprintf(cfg_error, sizeof(cfg_error), "Error binding to %s!", SOCK_FILE);
+		close(sock_listen);
+		sock_listen = -1;
+		return 1;
+	}
+
+	// Never block the scan waiting on clients
+	fcntl(sock_listen, F_SETFL, fcntl(sock_listen, F_GETFL) | O_NONBLOCK);
+
+	if (!config.quiet)
+		printf("OK\n");
+	return 0;
+}
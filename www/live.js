@@ -0,0 +1,105 @@
+/*
+ * live.js - Keeps the Bluelog Live device table current
+ *
+ * When the page comes from the web server built into Bluelog (-p), new and
+ * updated devices are pushed over /events and patched into the table, so
+ * the page never has to reload. Anywhere else (livelog.cgi under another
+ * web server, or browsers without EventSource) it just reloads every 20
+ * seconds like Bluelog Live always has.
+ */
+
+var live_refresh = 20000;
+
+function live_reload()
+{
+	window.location.reload();
+}
+
+function live_poll()
+{
+	setTimeout(live_reload, live_refresh);
+}
+
+// Update every "Discovered Devices" counter on the page
+function live_count(count)
+{
+	var divs = document.getElementsByTagName("div");
+	for (var i = 0; i < divs.length; i++)
+	{
+		var div = divs[i];
+		if (div.getElementsByTagName("div").length == 0 && /Discovered Devices: \d+/.test(div.innerHTML))
+			div.innerHTML = div.innerHTML.replace(/Discovered Devices: \d+/, "Discovered Devices: " + count);
+	}
+}
+
+// Event data is the MAC, a tab, then the table row
+function live_device(event)
+{
+	var split = event.data.indexOf("\t");
+	var addr = event.data.substring(0, split);
+	var table = document.getElementsByTagName("table")[0];
+	var holder = document.createElement("table");
+	var row, rows, i;
+
+	// First device, easier to let the server draw the table
+	if (!table)
+	{
+		live_reload();
+		return;
+	}
+
+	holder.innerHTML = event.data.substring(split + 1);
+	row = holder.getElementsByTagName("tr")[0];
+	if (!row)
+		return;
+
+	// Mobile page doesn't show hardware info
+	rows = table.rows;
+	while (row.cells.length > rows[0].cells.length)
+		row.deleteCell(-1);
+
+	// Seen again, replace the old row
+	for (i = 1; i < rows.length; i++)
+	{
+		if (rows[i].cells.length > 1 && rows[i].cells[1].innerHTML == addr)
+		{
+			rows[i].parentNode.replaceChild(row, rows[i]);
+			return;
+		}
+	}
+
+	// New device, newest go on top
+	rows[0].parentNode.insertBefore(row, rows.length > 1 ? rows[1] : null);
+	live_count(rows.length - 1);
+}
+
+function live_start()
+{
+	var source, opened = 0;
+
+	if (typeof EventSource == "undefined")
+	{
+		live_poll();
+		return;
+	}
+
+	source = new EventSource("../events");
+	source.addEventListener("device", live_device, false);
+	source.onopen = function()
+	{
+		// Reconnected, we may have missed something
+		if (opened++)
+			live_reload();
+	};
+	source.onerror = function()
+	{
+		// No event stream here, fall back on reloading
+		if (!opened)
+		{
+			source.close();
+			live_poll();
+		}
+	};
+}
+
+window.addEventListener("load", live_start, false);